@@ -0,0 +1,85 @@
+#include <stdlib.h>
+#include <string.h>
+
+// Bump allocator.  Memory is handed out from a chain of blocks and only
+// ever given back all at once by arena_reset(), which is O(1): the blocks
+// are kept for the next round of allocations.
+
+#define ARENA_BLOCK_SIZE (64 * 1024)
+
+typedef struct arenaBlock {
+	struct arenaBlock* next;
+	size_t size;
+	size_t used;
+	char data[];
+} arenaBlock;
+
+typedef struct {
+	arenaBlock* head;
+	arenaBlock* current;
+	size_t used; // bytes handed out since the last reset
+} arena;
+
+static arenaBlock* arena_newBlock(size_t size) {
+	arenaBlock* block = malloc(sizeof(arenaBlock) + size);
+	if (block == NULL) {
+		puts("Uh oh arena_newBlock");
+		exit(1);
+	}
+	block->next = NULL;
+	block->size = size;
+	block->used = 0;
+	return block;
+}
+
+arena* arena_create() {
+	arena* a = malloc(sizeof(arena));
+	a->head = arena_newBlock(ARENA_BLOCK_SIZE);
+	a->current = a->head;
+	a->used = 0;
+	return a;
+}
+
+void* arena_alloc(arena* a, size_t n) {
+	// Keep everything pointer aligned
+	n = (n + sizeof(void*) - 1) & ~(sizeof(void*) - 1);
+	arenaBlock* block = a->current;
+	while (block->used + n > block->size) {
+		if (block->next == NULL) {
+			size_t size = n > ARENA_BLOCK_SIZE ? n : ARENA_BLOCK_SIZE;
+			block->next = arena_newBlock(size);
+		}
+		// Blocks past current are stale from before the last reset
+		block = block->next;
+		block->used = 0;
+	}
+	a->current = block;
+	void* result = block->data + block->used;
+	block->used += n;
+	a->used += n;
+	return result;
+}
+
+// Copies len bytes of str and terminates them
+char* arena_strndup(arena* a, const char* str, size_t len) {
+	char* result = arena_alloc(a, len + 1);
+	memcpy(result, str, len);
+	result[len] = '\0';
+	return result;
+}
+
+void arena_reset(arena* a) {
+	a->current = a->head;
+	a->head->used = 0;
+	a->used = 0;
+}
+
+void arena_free(arena* a) {
+	arenaBlock* block = a->head;
+	while (block != NULL) {
+		arenaBlock* next = block->next;
+		free(block);
+		block = next;
+	}
+	free(a);
+}
@@ -0,0 +1,50 @@
+#include <X11/Xlib.h>
+
+// Every atom we read or write.  Interned together once at startup so that
+// the property getters never have to round trip to the server for them.
+// Predefined atoms (CARDINAL, ATOM, WM_CLASS) come from Xatom.h instead.
+enum {
+	ATOM_UTF8_STRING,
+	ATOM_WM_STATE,
+	ATOM_NET_WM_NAME,
+	ATOM_NET_WM_DESKTOP,
+	ATOM_NET_CURRENT_DESKTOP,
+	ATOM_NET_ACTIVE_WINDOW,
+	ATOM_NET_DESKTOP_NAMES,
+	ATOM_NET_CLIENT_LIST_STACKING,
+	ATOM_NET_WM_WINDOW_TYPE,
+	ATOM_NET_WM_WINDOW_TYPE_DOCK,
+	ATOM_NET_WM_STRUT,
+	ATOM_NET_WM_STRUT_PARTIAL,
+	ATOM_XDPAGER_DAEMON, // selection owned by a resident pager
+	ATOM_XDPAGER_TOGGLE, // client message asking it to show or hide
+	NUM_ATOMS
+};
+
+// Same order as the enum above
+static char* atomNames[NUM_ATOMS] = {
+	"UTF8_STRING",
+	"WM_STATE",
+	"_NET_WM_NAME",
+	"_NET_WM_DESKTOP",
+	"_NET_CURRENT_DESKTOP",
+	"_NET_ACTIVE_WINDOW",
+	"_NET_DESKTOP_NAMES",
+	"_NET_CLIENT_LIST_STACKING",
+	"_NET_WM_WINDOW_TYPE",
+	"_NET_WM_WINDOW_TYPE_DOCK",
+	"_NET_WM_STRUT",
+	"_NET_WM_STRUT_PARTIAL",
+	"_XDPAGER_DAEMON",
+	"_XDPAGER_TOGGLE",
+};
+
+// One batched request for the whole table
+Atom* internAtoms(Display* dpy) {
+	Atom* atoms = malloc(NUM_ATOMS * sizeof(Atom));
+	if (!XInternAtoms(dpy, atomNames, NUM_ATOMS, False, atoms)) {
+		printf("Failed to intern atoms\n");
+		exit(1);
+	}
+	return atoms;
+}
@@ -0,0 +1,119 @@
+#include <X11/Xlib-xcb.h>
+#include <xcb/xcb.h>
+
+// Everything testX() needs to know about a single root child
+typedef struct {
+	Window window;
+	char valid; // 0 if the window was destroyed before the replies came back
+	int x;
+	int y;
+	int width;
+	int height;
+	char override;
+	char mapped;
+	long state;
+	int desktop;
+	char* className;
+	char* name;
+} WindowInfo;
+
+typedef struct {
+	xcb_get_window_attributes_cookie_t attrs;
+	xcb_get_geometry_cookie_t geometry;
+	xcb_get_property_cookie_t name;
+	xcb_get_property_cookie_t className;
+	xcb_get_property_cookie_t state;
+	xcb_get_property_cookie_t desktop;
+} WindowCookies;
+
+static char* copyPropString(arena* a, xcb_get_property_reply_t* reply) {
+	if (reply == NULL || reply->format != 8 || xcb_get_property_value_length(reply) == 0)
+		return NULL;
+	int len = xcb_get_property_value_length(reply);
+	char* value = xcb_get_property_value(reply);
+	return arena_strndup(a, value, strnlen(value, len));
+}
+
+// WM_CLASS is "instance\0class\0", we only care about the class
+static char* copyPropClass(arena* a, xcb_get_property_reply_t* reply) {
+	if (reply == NULL || reply->format != 8)
+		return NULL;
+	int len = xcb_get_property_value_length(reply);
+	char* value = xcb_get_property_value(reply);
+	int instanceLen = strnlen(value, len);
+	if (instanceLen + 1 >= len)
+		return NULL;
+	char* className = value + instanceLen + 1;
+	return arena_strndup(a, className, strnlen(className, len - instanceLen - 1));
+}
+
+static long firstCardinal(xcb_get_property_reply_t* reply, long fallback) {
+	if (reply == NULL || reply->format != 32 || xcb_get_property_value_length(reply) < 4)
+		return fallback;
+	return *(int32_t*)xcb_get_property_value(reply);
+}
+
+// Fetch attributes, geometry and the WM properties of every window at once.
+// All requests are sent before the first reply is waited on, so this costs
+// a single round trip no matter how many windows there are (compared to
+// five blocking round trips per window through Xlib).
+// Xlib Atoms and xcb_atom_t are the same server ids, so the table from
+// internAtoms() is used as is.  Strings are allocated from the given arena.
+WindowInfo* fetchWindowInfos(Display* dpy, Atom* atoms, arena* a, Window* windows, int n) {
+	xcb_connection_t* c = XGetXCBConnection(dpy);
+
+	WindowCookies* cookies = malloc(n * sizeof(WindowCookies));
+	for (int i=0; i<n; i++) {
+		xcb_window_t w = windows[i];
+		cookies[i].attrs = xcb_get_window_attributes(c, w);
+		cookies[i].geometry = xcb_get_geometry(c, w);
+		cookies[i].name = xcb_get_property(c, 0, w, atoms[ATOM_NET_WM_NAME], atoms[ATOM_UTF8_STRING], 0, 100);
+		cookies[i].className = xcb_get_property(c, 0, w, XCB_ATOM_WM_CLASS, XCB_GET_PROPERTY_TYPE_ANY, 0, 100);
+		cookies[i].state = xcb_get_property(c, 0, w, atoms[ATOM_WM_STATE], XCB_GET_PROPERTY_TYPE_ANY, 0, 100);
+		cookies[i].desktop = xcb_get_property(c, 0, w, atoms[ATOM_NET_WM_DESKTOP], XCB_ATOM_CARDINAL, 0, 100);
+	}
+	xcb_flush(c);
+
+	// Errors (windows destroyed in the meantime) come back through the reply
+	// instead of the Xlib error handler, the window is just marked invalid
+	WindowInfo* infos = malloc(n * sizeof(WindowInfo));
+	for (int i=0; i<n; i++) {
+		WindowInfo* info = &infos[i];
+		xcb_get_window_attributes_reply_t* attrs = xcb_get_window_attributes_reply(c, cookies[i].attrs, NULL);
+		xcb_get_geometry_reply_t* geometry = xcb_get_geometry_reply(c, cookies[i].geometry, NULL);
+		xcb_get_property_reply_t* name = xcb_get_property_reply(c, cookies[i].name, NULL);
+		xcb_get_property_reply_t* className = xcb_get_property_reply(c, cookies[i].className, NULL);
+		xcb_get_property_reply_t* state = xcb_get_property_reply(c, cookies[i].state, NULL);
+		xcb_get_property_reply_t* desktop = xcb_get_property_reply(c, cookies[i].desktop, NULL);
+
+		info->window = windows[i];
+		info->valid = attrs != NULL && geometry != NULL;
+		if (info->valid) {
+			info->x = geometry->x;
+			info->y = geometry->y;
+			info->width = geometry->width;
+			info->height = geometry->height;
+			info->override = attrs->override_redirect;
+			info->mapped = attrs->map_state != XCB_MAP_STATE_UNMAPPED;
+		}
+		info->state = firstCardinal(state, 0);
+		info->desktop = firstCardinal(desktop, -1);
+		info->name = NULL;
+		info->className = NULL;
+		// Nobody keeps the strings of override-redirect windows
+		if (info->valid && !info->override) {
+			info->name = copyPropString(a, name);
+			info->className = copyPropClass(a, className);
+		}
+
+		free(attrs);
+		free(geometry);
+		free(name);
+		free(className);
+		free(state);
+		free(desktop);
+	}
+	free(cookies);
+
+	return infos;
+}
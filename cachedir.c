@@ -0,0 +1,38 @@
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+// Files kept between launches live in $XDG_CACHE_HOME/xdpager, or
+// ~/.cache/xdpager when that isn't set.  All of them can be deleted at
+// any time, they only save work.
+
+// The path of name in the cache directory, NULL if there's no home to put it in
+char* cachePath(char* name) {
+	char* cache = getenv("XDG_CACHE_HOME");
+	char* home = getenv("HOME");
+	if (cache == NULL && home == NULL)
+		return NULL;
+	char* format = cache ? "%s/xdpager/%s" : "%s/.cache/xdpager/%s";
+	char* base = cache ? cache : home;
+	int len = snprintf(NULL, 0, format, base, name);
+	char* path = malloc(len + 1);
+	sprintf(path, format, base, name);
+	return path;
+}
+
+// Makes the directory path is in, and the one above it
+void makeCacheDir(char* path) {
+	char dir[strlen(path) + 1];
+	strcpy(dir, path);
+	char* slash = strrchr(dir, '/');
+	if (slash == NULL)
+		return;
+	*slash = '\0';
+	char* parent = strrchr(dir, '/');
+	if (parent) {
+		*parent = '\0';
+		mkdir(dir, 0755);
+		*parent = '/';
+	}
+	mkdir(dir, 0755);
+}
@@ -10,6 +10,12 @@ typedef struct {
 	unsigned short desktopsPerRow;
 	unsigned int margin;
 	unsigned int navType;
+	unsigned int clientList;
+	unsigned int renderer;
+	unsigned int thumbnails;
+	unsigned int thumbnailCache;
+	unsigned int daemon;
+	unsigned int timings;
 	char* desktopFg;
 	char* desktopBg;
 	char* selectedColor;
@@ -30,6 +36,12 @@ XDConfig* defaultConfig() {
 	cfg->selectedColor = "#f2e750";
 	cfg->fontColor = "#cfc542";
 	cfg->navType = 1;
+	cfg->clientList = 0;
+	cfg->renderer = 0;
+	cfg->thumbnails = 0;
+	cfg->thumbnailCache = 32;
+	cfg->daemon = 0;
+	cfg->timings = 0;
 	cfg->nDesktops = 9;
 	cfg->desktopsPerRow = 3;
 	cfg->font= "Font Awesome 6 Free Solid,Font Awesome 6 Brands,monospace";
@@ -59,6 +71,12 @@ void parseArgs(int argc, char* argv[], XDConfig* cfg) {
 			{"desktopsPerRow", required_argument, 0, 6},
 			{"font", required_argument, 0, 7},
 			{"windowFont", required_argument, 0, 8},
+			{"clientList", required_argument, 0, 9},
+			{"renderer", required_argument, 0, 10},
+			{"thumbnails", required_argument, 0, 11},
+			{"thumbnailCache", required_argument, 0, 12},
+			{"daemon", required_argument, 0, 13},
+			{"timings", no_argument, 0, 14},
 
 		};
 		int opt_idx = 0;
@@ -101,6 +119,24 @@ void parseArgs(int argc, char* argv[], XDConfig* cfg) {
 				cfg->windowFont = malloc(strlen(optarg));
 				strcpy(cfg->windowFont, optarg);
 				break;
+			case 9:
+				cfg->clientList = strtoul(optarg, NULL, 10);
+				break;
+			case 10:
+				cfg->renderer = strtoul(optarg, NULL, 10);
+				break;
+			case 11:
+				cfg->thumbnails = strtoul(optarg, NULL, 10);
+				break;
+			case 12:
+				cfg->thumbnailCache = strtoul(optarg, NULL, 10);
+				break;
+			case 13:
+				cfg->daemon = strtoul(optarg, NULL, 10);
+				break;
+			case 14:
+				cfg->timings = 1;
+				break;
 			case 'c':
 				// config file determined elsewhere
 				break;
@@ -189,6 +225,16 @@ int parseline(char* line, XDConfig* config) {
 			config->margin = strtoul(token, NULL, 10);
 		} else if (strcmp(key, "navType") == 0) {
 			config->navType = strtoul(token, NULL, 10);
+		} else if (strcmp(key, "clientList") == 0) {
+			config->clientList = strtoul(token, NULL, 10);
+		} else if (strcmp(key, "renderer") == 0) {
+			config->renderer = strtoul(token, NULL, 10);
+		} else if (strcmp(key, "thumbnails") == 0) {
+			config->thumbnails = strtoul(token, NULL, 10);
+		} else if (strcmp(key, "thumbnailCache") == 0) {
+			config->thumbnailCache = strtoul(token, NULL, 10);
+		} else if (strcmp(key, "daemon") == 0) {
+			config->daemon = strtoul(token, NULL, 10);
 		} else if (strcmp(key, "searchPrefix") == 0) {
 			config->searchPrefix = malloc(sizeof(char) * strlen(token));
 			strcpy(config->searchPrefix, token);
@@ -0,0 +1,96 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Growable array that stores its elements inline, back to back.
+// Iterating it is a linear scan over packed memory instead of chasing a
+// pointer per element.
+
+typedef struct {
+	char* data;
+	int elemSize;
+	int size;
+	int capacity;
+} darray;
+
+// Element i of an array of type
+#define DARRAY_AT(list, type, i) (((type*)(list)->data)[i])
+
+darray* darray_create(int elemSize) {
+	darray* list = malloc(sizeof(darray));
+	list->elemSize = elemSize;
+	list->size = 0;
+	list->capacity = 16;
+	list->data = malloc(list->capacity * elemSize);
+	return list;
+}
+
+// Makes room for at least n elements
+void darray_reserve(darray* list, int n) {
+	if (n <= list->capacity)
+		return;
+	int capacity = list->capacity;
+	while (capacity < n)
+		capacity *= 2;
+	char* data = realloc(list->data, capacity * list->elemSize);
+	if (data == NULL) {
+		puts("Uh oh darray_reserve");
+		exit(1);
+	}
+	list->data = data;
+	list->capacity = capacity;
+}
+
+void* darray_get(darray* list, int pos) {
+	if (pos < 0 || pos >= list->size)
+		return NULL;
+	return list->data + pos * list->elemSize;
+}
+
+// Copies elem into position pos, shifting everything after it up one
+void darray_insert(darray* list, int pos, void* elem) {
+	if (pos < 0)
+		pos = 0;
+	if (pos > list->size)
+		pos = list->size;
+	darray_reserve(list, list->size + 1);
+	char* slot = list->data + pos * list->elemSize;
+	memmove(slot + list->elemSize, slot, (list->size - pos) * list->elemSize);
+	memcpy(slot, elem, list->elemSize);
+	list->size++;
+}
+
+void darray_addBack(darray* list, void* elem) {
+	darray_reserve(list, list->size + 1);
+	memcpy(list->data + list->size * list->elemSize, elem, list->elemSize);
+	list->size++;
+}
+
+void darray_remove(darray* list, int pos) {
+	if (pos < 0 || pos >= list->size) {
+		printf("out of bounds pos %d\n", pos);
+		return;
+	}
+	char* slot = list->data + pos * list->elemSize;
+	memmove(slot, slot + list->elemSize, (list->size - pos - 1) * list->elemSize);
+	list->size--;
+}
+
+// For arrays of pointers: the index of ptr, or -1
+int darray_indexOf(darray* list, void* ptr) {
+	void** items = (void**)list->data;
+	for (int i=0; i<list->size; i++) {
+		if (items[i] == ptr)
+			return i;
+	}
+	return -1;
+}
+
+void darray_clear(darray* list) {
+	list->size = 0;
+}
+
+void darray_free(darray* list) {
+	free(list->data);
+	free(list);
+}
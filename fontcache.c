@@ -0,0 +1,142 @@
+// Open XftFonts keyed by (font spec, pixelsize).  Opening a font means a
+// fontconfig match, which is slow enough to show during an interactive
+// resize, so fonts nobody uses anymore are kept open in case the pager goes
+// back to that size.  Only the least recently used of those get closed once
+// there are more than capacity of them.  What each font matched is also
+// kept on disk (see fontdisk.c) so that the next launch can skip matching.
+
+typedef struct {
+	char* spec; // as given in the config, without the size
+	int pixelsize;
+	XftFont* font;
+	int refs; // fontlists currently holding it
+	unsigned long lastUsed;
+} fontcacheEntry;
+
+typedef struct {
+	darray* entries; // fontcacheEntry
+	int capacity;    // unreferenced fonts kept open
+	unsigned long clock;
+	fontdisk* disk;  // matches from earlier launches, NULL without a cache directory
+} fontcache;
+
+fontcache* fontcache_create(int capacity, fontdisk* disk) {
+	fontcache* cache = malloc(sizeof(fontcache));
+	cache->entries = darray_create(sizeof(fontcacheEntry));
+	cache->capacity = capacity;
+	cache->clock = 0;
+	cache->disk = disk;
+	return cache;
+}
+
+// Opens the match saved for spec at pixelsize, NULL if there's none or its
+// file can't be opened anymore
+static XftFont* fontcache_openSaved(fontcache* cache, Display* dpy, char* spec, int pixelsize) {
+	FcPattern* match = fontdisk_lookup(cache->disk, spec, pixelsize);
+	if (match == NULL)
+		return NULL;
+	XftFont* font = XftFontOpenPattern(dpy, match);
+	if (!font) {
+		FcPatternDestroy(match);
+		fontdisk_forget(cache->disk, spec, pixelsize);
+	}
+	return font;
+}
+
+// Returns spec at pixelsize, opening it if it isn't already.  Every open has
+// to be paired with a fontcache_release().
+XftFont* fontcache_open(fontcache* cache, Display* dpy, int screen, char* spec, int pixelsize) {
+	for (int i=0; i<cache->entries->size; i++) {
+		fontcacheEntry* e = &DARRAY_AT(cache->entries, fontcacheEntry, i);
+		if (e->pixelsize == pixelsize && strcmp(e->spec, spec) == 0) {
+			e->refs++;
+			e->lastUsed = ++cache->clock;
+			return e->font;
+		}
+	}
+
+	XftFont* font = fontcache_openSaved(cache, dpy, spec, pixelsize);
+	if (!font) {
+		int len = snprintf(NULL, 0, "%s:pixelsize=%d", spec, pixelsize);
+		char fontWithSize[len + 1];
+		sprintf(fontWithSize, "%s:pixelsize=%d", spec, pixelsize);
+		font = XftFontOpenName(dpy, screen, fontWithSize);
+		if (!font) {
+			printf("failed to open font %s\n", spec);
+			exit(1);
+		}
+		fontdisk_store(cache->disk, spec, pixelsize, font->pattern);
+	}
+
+	fontcacheEntry e;
+	e.spec = strdup(spec);
+	e.pixelsize = pixelsize;
+	e.font = font;
+	e.refs = 1;
+	e.lastUsed = ++cache->clock;
+	darray_addBack(cache->entries, &e);
+	return font;
+}
+
+// Takes a font matched ahead of time (see fontmatch.c) as spec at
+// pixelsize, opened but unreferenced until fontcache_open() asks for it
+void fontcache_adopt(fontcache* cache, Display* dpy, char* spec, int pixelsize, FcPattern* match) {
+	// Xft owns match from here on, and frees it if the font was already open
+	XftFont* font = XftFontOpenPattern(dpy, match);
+	if (!font) {
+		FcPatternDestroy(match);
+		return; // fontcache_open() will complain about it
+	}
+	fontcacheEntry e;
+	e.spec = strdup(spec);
+	e.pixelsize = pixelsize;
+	e.font = font;
+	fontdisk_store(cache->disk, spec, pixelsize, font->pattern);
+	e.refs = 0;
+	e.lastUsed = ++cache->clock;
+	darray_addBack(cache->entries, &e);
+}
+
+// Xft hands out the same XftFont for every spec and size that matched the
+// same font, so several entries can hold it.  Each holds a reference of
+// its own on it, releasing it once from any of them keeps the counts right.
+void fontcache_release(fontcache* cache, Display* dpy, XftFont* font) {
+	int unused = 0;
+	char released = 0;
+	for (int i=0; i<cache->entries->size; i++) {
+		fontcacheEntry* e = &DARRAY_AT(cache->entries, fontcacheEntry, i);
+		if (!released && e->font == font && e->refs > 0) {
+			e->refs--;
+			released = 1;
+		}
+		if (e->refs == 0)
+			unused++;
+	}
+
+	while (unused > cache->capacity) {
+		int oldest = -1;
+		for (int i=0; i<cache->entries->size; i++) {
+			fontcacheEntry* e = &DARRAY_AT(cache->entries, fontcacheEntry, i);
+			if (e->refs == 0 && (oldest < 0 ||
+					e->lastUsed < DARRAY_AT(cache->entries, fontcacheEntry, oldest).lastUsed))
+				oldest = i;
+		}
+		fontcacheEntry* e = &DARRAY_AT(cache->entries, fontcacheEntry, oldest);
+		XftFontClose(dpy, e->font);
+		free(e->spec);
+		darray_remove(cache->entries, oldest);
+		unused--;
+	}
+}
+
+void fontcache_free(fontcache* cache, Display* dpy) {
+	for (int i=0; i<cache->entries->size; i++) {
+		fontcacheEntry* e = &DARRAY_AT(cache->entries, fontcacheEntry, i);
+		XftFontClose(dpy, e->font);
+		free(e->spec);
+	}
+	darray_free(cache->entries);
+	if (cache->disk)
+		fontdisk_free(cache->disk);
+	free(cache);
+}
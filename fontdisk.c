@@ -0,0 +1,265 @@
+#include <pthread.h>
+
+// Which font fontconfig matched each (font spec, pixelsize) to, kept on
+// disk so later launches open fonts straight from the matched pattern
+// instead of matching again.  Matches stay valid as long as fontconfig's
+// configuration and fonts do, so the file is tagged with a stamp of both:
+// the fontconfig version and the newest modification time among its config
+// files, font directories and cache directories (fc-cache touches those
+// when fonts are installed).  A file with another stamp is ignored.
+// Taking the stamp means parsing fontconfig's configuration, so it's done
+// on a thread of its own, joined the first time a match is asked for.
+//
+// Every size passed during a resize would otherwise stay forever, so only
+// the sizes of a spec used most recently are kept, and only while they've
+// been used within the last few launches.
+//
+// The file is plain text, a "stamp<TAB>launch" line followed by one
+// "launch<TAB>pixelsize<TAB>spec<TAB>pattern" line per match, launch being
+// the last one that used it.
+
+#define FONTDISK_SIZES 4     // per spec
+#define FONTDISK_LAUNCHES 16 // unused for this many launches and it's dropped
+
+typedef struct {
+	char* spec;
+	int pixelsize;
+	char* pattern; // FcNameUnparse()d match
+	int launch;    // last one that used it
+	unsigned long lastUsed; // in this launch, 0 if it hasn't been
+} fontdiskEntry;
+
+typedef struct {
+	char* path;
+	char stamp[64];
+	int launch;      // counts up once per launch that saves
+	darray* entries; // fontdiskEntry
+	char dirty;      // changed since loading
+	unsigned long clock;
+	pthread_t loader;
+	char loading;    // the loader thread still has to be joined
+} fontdisk;
+
+static void fontdisk_newest(FcStrList* list, time_t* newest) {
+	FcChar8* file;
+	struct stat st;
+	while ((file = FcStrListNext(list)) != NULL) {
+		if (stat((char*)file, &st) == 0 && st.st_mtime > *newest)
+			*newest = st.st_mtime;
+	}
+	FcStrListDone(list);
+}
+
+// Loading the configuration without its fonts is the cheap part of fontconfig
+static void fontdisk_stamp(char* stamp, int size) {
+	time_t newest = 0;
+	FcConfig* config = FcInitLoadConfig();
+	if (config != NULL) {
+		fontdisk_newest(FcConfigGetConfigFiles(config), &newest);
+		fontdisk_newest(FcConfigGetFontDirs(config), &newest);
+		fontdisk_newest(FcConfigGetCacheDirs(config), &newest);
+		FcConfigDestroy(config);
+	}
+	snprintf(stamp, size, "xdpager-fonts %d %lld", FcGetVersion(), (long long)newest);
+}
+
+static void fontdisk_add(fontdisk* disk, char* spec, int pixelsize, char* pattern, int launch) {
+	fontdiskEntry e;
+	e.spec = strdup(spec);
+	e.pixelsize = pixelsize;
+	e.pattern = strdup(pattern);
+	e.launch = launch;
+	e.lastUsed = 0;
+	darray_addBack(disk->entries, &e);
+}
+
+static void fontdisk_drop(fontdisk* disk, int i) {
+	fontdiskEntry* e = &DARRAY_AT(disk->entries, fontdiskEntry, i);
+	free(e->spec);
+	free(e->pattern);
+	darray_remove(disk->entries, i);
+	disk->dirty = 1;
+}
+
+// Ties go to the one saved later, so that every entry has a rank
+static char fontdisk_newer(fontdiskEntry* a, int ai, fontdiskEntry* b, int bi) {
+	if (a->launch != b->launch)
+		return a->launch > b->launch;
+	return a->lastUsed != b->lastUsed ? a->lastUsed > b->lastUsed : ai > bi;
+}
+
+// Drops the matches that are too old, and the sizes of a spec past the
+// FONTDISK_SIZES most recently used
+static void fontdisk_prune(fontdisk* disk) {
+	for (int i=0; i<disk->entries->size; ) {
+		fontdiskEntry* e = &DARRAY_AT(disk->entries, fontdiskEntry, i);
+		int newer = 0;
+		for (int j=0; j<disk->entries->size; j++) {
+			fontdiskEntry* other = &DARRAY_AT(disk->entries, fontdiskEntry, j);
+			if (j != i && strcmp(other->spec, e->spec) == 0 && fontdisk_newer(other, j, e, i))
+				newer++;
+		}
+		if (newer >= FONTDISK_SIZES || disk->launch - e->launch >= FONTDISK_LAUNCHES)
+			fontdisk_drop(disk, i);
+		else
+			i++;
+	}
+}
+
+// Reads the matches saved under the current stamp, if there are any
+static void* fontdisk_load(void* arg) {
+	fontdisk* disk = arg;
+	fontdisk_stamp(disk->stamp, sizeof(disk->stamp));
+	FILE* f = fopen(disk->path, "r");
+	if (f == NULL)
+		return NULL;
+	char* line = NULL;
+	size_t cap = 0;
+	ssize_t len = getline(&line, &cap, f);
+	if (len > 0 && line[len - 1] == '\n')
+		line[--len] = '\0';
+	char* launch = len > 0 ? strchr(line, '\t') : NULL;
+	if (launch != NULL)
+		*launch++ = '\0';
+	if (launch == NULL || strcmp(line, disk->stamp) != 0) {
+		disk->dirty = 1; // stale, rewrite it
+	} else {
+		disk->launch = strtol(launch, NULL, 10) + 1;
+		while ((len = getline(&line, &cap, f)) > 0) {
+			if (line[len - 1] == '\n')
+				line[len - 1] = '\0';
+			char* pixelsize = strchr(line, '\t');
+			char* spec = pixelsize ? strchr(pixelsize + 1, '\t') : NULL;
+			char* pattern = spec ? strchr(spec + 1, '\t') : NULL;
+			if (pattern == NULL)
+				continue;
+			*pixelsize++ = '\0';
+			*spec++ = '\0';
+			*pattern++ = '\0';
+			fontdisk_add(disk, spec, strtol(pixelsize, NULL, 10), pattern, strtol(line, NULL, 10));
+		}
+		fontdisk_prune(disk);
+	}
+	free(line);
+	fclose(f);
+	return NULL;
+}
+
+// Starts loading the matches of earlier launches in the background
+fontdisk* fontdisk_create() {
+	char* path = cachePath("fonts");
+	if (path == NULL)
+		return NULL;
+	fontdisk* disk = malloc(sizeof(fontdisk));
+	disk->path = path;
+	disk->launch = 0;
+	disk->entries = darray_create(sizeof(fontdiskEntry));
+	disk->dirty = 0;
+	disk->clock = 0;
+	disk->loading = pthread_create(&disk->loader, NULL, fontdisk_load, disk) == 0;
+	if (!disk->loading)
+		fontdisk_load(disk);
+	return disk;
+}
+
+// Waits for the loader, the entries may only be touched after this
+static void fontdisk_ready(fontdisk* disk) {
+	if (disk->loading) {
+		pthread_join(disk->loader, NULL);
+		disk->loading = 0;
+	}
+}
+
+// Finding a match counts as using it
+static fontdiskEntry* fontdisk_find(fontdisk* disk, char* spec, int pixelsize) {
+	fontdisk_ready(disk);
+	for (int i=0; i<disk->entries->size; i++) {
+		fontdiskEntry* e = &DARRAY_AT(disk->entries, fontdiskEntry, i);
+		if (e->pixelsize == pixelsize && strcmp(e->spec, spec) == 0) {
+			if (e->launch != disk->launch)
+				disk->dirty = 1;
+			e->launch = disk->launch;
+			e->lastUsed = ++disk->clock;
+			return e;
+		}
+	}
+	return NULL;
+}
+
+char fontdisk_has(fontdisk* disk, char* spec, int pixelsize) {
+	return disk != NULL && fontdisk_find(disk, spec, pixelsize) != NULL;
+}
+
+// The saved match of spec at pixelsize, NULL if there's none.  The caller owns it.
+FcPattern* fontdisk_lookup(fontdisk* disk, char* spec, int pixelsize) {
+	fontdiskEntry* e = disk ? fontdisk_find(disk, spec, pixelsize) : NULL;
+	return e ? FcNameParse((FcChar8*)e->pattern) : NULL;
+}
+
+// Remembers what spec at pixelsize matched
+void fontdisk_store(fontdisk* disk, char* spec, int pixelsize, FcPattern* match) {
+	if (disk == NULL || fontdisk_find(disk, spec, pixelsize) != NULL)
+		return;
+	FcChar8* pattern = FcNameUnparse(match);
+	if (pattern == NULL)
+		return;
+	// One match per line
+	if (strchr((char*)pattern, '\n') == NULL && strchr(spec, '\t') == NULL && strchr(spec, '\n') == NULL) {
+		fontdisk_add(disk, spec, pixelsize, (char*)pattern, disk->launch);
+		DARRAY_AT(disk->entries, fontdiskEntry, disk->entries->size - 1).lastUsed = ++disk->clock;
+		disk->dirty = 1;
+		fontdisk_prune(disk);
+	}
+	free(pattern);
+}
+
+// A saved match that couldn't be opened (the file is gone), match it again next time
+void fontdisk_forget(fontdisk* disk, char* spec, int pixelsize) {
+	if (disk == NULL)
+		return;
+	fontdisk_ready(disk);
+	for (int i=0; i<disk->entries->size; i++) {
+		fontdiskEntry* e = &DARRAY_AT(disk->entries, fontdiskEntry, i);
+		if (e->pixelsize == pixelsize && strcmp(e->spec, spec) == 0) {
+			fontdisk_drop(disk, i);
+			return;
+		}
+	}
+}
+
+// Writes the file if anything changed, replacing it in one go
+void fontdisk_save(fontdisk* disk) {
+	if (disk == NULL)
+		return;
+	fontdisk_ready(disk);
+	if (!disk->dirty)
+		return;
+	makeCacheDir(disk->path);
+	char tmp[strlen(disk->path) + 5];
+	sprintf(tmp, "%s.tmp", disk->path);
+	FILE* f = fopen(tmp, "w");
+	if (f == NULL)
+		return;
+	fprintf(f, "%s\t%d\n", disk->stamp, disk->launch);
+	for (int i=0; i<disk->entries->size; i++) {
+		fontdiskEntry* e = &DARRAY_AT(disk->entries, fontdiskEntry, i);
+		fprintf(f, "%d\t%d\t%s\t%s\n", e->launch, e->pixelsize, e->spec, e->pattern);
+	}
+	if (fclose(f) != 0 || rename(tmp, disk->path) != 0) {
+		unlink(tmp);
+		return;
+	}
+	disk->dirty = 0;
+}
+
+void fontdisk_free(fontdisk* disk) {
+	fontdisk_ready(disk);
+	for (int i=0; i<disk->entries->size; i++) {
+		fontdiskEntry* e = &DARRAY_AT(disk->entries, fontdiskEntry, i);
+		free(e->spec);
+		free(e->pattern);
+	}
+	darray_free(disk->entries);
+	free(disk->path);
+	free(disk);
+}
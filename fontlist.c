@@ -0,0 +1,205 @@
+#include <stdint.h>
+
+// A fallback chain of fonts along with which font each codepoint is drawn
+// with, so XftCharExists only runs the first time a codepoint is seen.
+// Codepoints in the BMP are looked up in a dense table, anything above it
+// (emoji, icon fonts in the private planes) in a hash.  Entries hold the
+// index of the font plus one, or FONTLIST_NONE if no font has the glyph.
+//
+// Strings are drawn as runs: the glyph ids of a string and the font and
+// offset of each, cut off where the string stops fitting its maximum width.
+// Runs are cached by (string, max width), since the same titles and labels
+// are drawn over and over at the same size.
+
+#define FONTLIST_BMP 0x10000
+#define FONTLIST_NONE 0xff
+#define FONTLIST_RUNS 512 // slots in the run cache, a power of two
+
+typedef struct {
+	char* text; // NULL if the slot is empty
+	int len;
+	int maxWidth;
+	unsigned int hash;
+	int n;
+	XftGlyphFontSpec* glyphs; // positions relative to the start of the run
+} fontrun;
+
+typedef struct {
+	darray* specs;      // char*, the font names from the config, in fallback order
+	darray* fonts;      // XftFont*, specs opened at the current size
+	unsigned char* bmp; // per BMP codepoint, 0 if not looked up yet
+	wtable* astral;     // codepoints above the BMP
+	fontrun* runs;      // open addressing on hash
+	int nRuns;
+	darray* scratch;    // XftGlyphFontSpec, for shaping and positioning runs
+} fontlist;
+
+fontlist* fontlist_create() {
+	fontlist* list = malloc(sizeof(fontlist));
+	list->specs = darray_create(sizeof(char*));
+	list->fonts = darray_create(sizeof(XftFont*));
+	list->bmp = calloc(FONTLIST_BMP, 1);
+	list->astral = wtable_create();
+	list->runs = calloc(FONTLIST_RUNS, sizeof(fontrun));
+	list->nRuns = 0;
+	list->scratch = darray_create(sizeof(XftGlyphFontSpec));
+	return list;
+}
+
+// Splits a comma delimited font string into the specs of the chain
+void fontlist_parse(fontlist* list, char* rawFont) {
+	char* start = rawFont;
+	while (*start) {
+		char* end = strchr(start, ',');
+		int len = end ? end - start : strlen(start);
+		if (len > 0) {
+			char* spec = strndup(start, len);
+			darray_addBack(list->specs, &spec);
+		}
+		start += end ? len + 1 : len;
+	}
+}
+
+static void fontlist_clearRuns(fontlist* list) {
+	for (int i=0; i<FONTLIST_RUNS; i++) {
+		fontrun* run = &list->runs[i];
+		if (run->text) {
+			free(run->text);
+			free(run->glyphs);
+			run->text = NULL;
+		}
+	}
+	list->nRuns = 0;
+}
+
+// Forget every lookup and run, the fonts are about to change
+void fontlist_invalidate(fontlist* list) {
+	memset(list->bmp, 0, FONTLIST_BMP);
+	wtable_clear(list->astral);
+	fontlist_clearRuns(list);
+}
+
+static int fontlist_search(fontlist* list, Display* dpy, unsigned int rune) {
+	// Index + 1 has to fit next to FONTLIST_NONE
+	int n = list->fonts->size < FONTLIST_NONE - 1 ? list->fonts->size : FONTLIST_NONE - 1;
+	for (int i=0; i<n; i++) {
+		if (XftCharExists(dpy, DARRAY_AT(list->fonts, XftFont*, i), rune))
+			return i + 1;
+	}
+	fprintf(stderr,"char U+%04X not in fonts\n", rune);
+	return FONTLIST_NONE;
+}
+
+// The first font in the chain that has rune, or NULL if none of them do
+XftFont* fontlist_lookup(fontlist* list, Display* dpy, unsigned int rune) {
+	int entry;
+	if (rune < FONTLIST_BMP) {
+		entry = list->bmp[rune];
+		if (entry == 0)
+			entry = list->bmp[rune] = fontlist_search(list, dpy, rune);
+	} else {
+		entry = (uintptr_t)wtable_get(list->astral, rune);
+		if (entry == 0) {
+			entry = fontlist_search(list, dpy, rune);
+			wtable_put(list->astral, rune, (void*)(uintptr_t)entry);
+		}
+	}
+	return entry == FONTLIST_NONE ? NULL : DARRAY_AT(list->fonts, XftFont*, entry - 1);
+}
+
+// FNV-1a
+static unsigned int fontlist_hash(char* text, int len, int maxWidth) {
+	unsigned int hash = 2166136261u;
+	for (int i=0; i<len; i++)
+		hash = (hash ^ (unsigned char)text[i]) * 16777619u;
+	return (hash ^ maxWidth) * 16777619u;
+}
+
+// Glyphs of text in their fallback fonts, up to the last one that ends
+// before maxWidth (no limit if negative)
+static void fontlist_shape(fontlist* list, Display* dpy, char* text, int len, int maxWidth, fontrun* run) {
+	int err, tw = 0;
+	char *t, *next;
+	unsigned int rune;
+	XGlyphInfo ext;
+
+	darray* specs = list->scratch;
+	darray_clear(specs);
+	for (t=text; t - text < len; t = next) {
+		next = utf8_decode(t, &rune, &err);
+		XftFont* f = fontlist_lookup(list, dpy, rune);
+		if (f == NULL)
+			continue;
+		XftGlyphFontSpec spec;
+		spec.font = f;
+		spec.glyph = XftCharIndex(dpy, f, rune);
+		spec.x = tw;
+		spec.y = 0;
+		XftGlyphExtents(dpy, f, &spec.glyph, 1, &ext);
+		tw += ext.xOff;
+		if (maxWidth >= 0 && tw >= maxWidth)
+			break;
+		darray_addBack(specs, &spec);
+	}
+
+	run->n = specs->size;
+	run->glyphs = malloc((specs->size ? specs->size : 1) * sizeof(XftGlyphFontSpec));
+	memcpy(run->glyphs, specs->data, specs->size * sizeof(XftGlyphFontSpec));
+}
+
+// The run of text cut to maxWidth, shaping it on first use
+fontrun* fontlist_run(fontlist* list, Display* dpy, char* text, int len, int maxWidth) {
+	unsigned int hash = fontlist_hash(text, len, maxWidth);
+	int i = hash & (FONTLIST_RUNS - 1);
+	while (list->runs[i].text != NULL) {
+		fontrun* run = &list->runs[i];
+		if (run->hash == hash && run->len == len && run->maxWidth == maxWidth &&
+				memcmp(run->text, text, len) == 0)
+			return run;
+		i = (i + 1) & (FONTLIST_RUNS - 1);
+	}
+
+	// Titles come and go, start over rather than let the probes get long
+	if ((list->nRuns + 1) * 4 > FONTLIST_RUNS * 3) {
+		fontlist_clearRuns(list);
+		i = hash & (FONTLIST_RUNS - 1);
+	}
+	fontrun* run = &list->runs[i];
+	run->text = malloc(len);
+	memcpy(run->text, text, len);
+	run->len = len;
+	run->maxWidth = maxWidth;
+	run->hash = hash;
+	fontlist_shape(list, dpy, text, len, maxWidth, run);
+	list->nRuns++;
+	return run;
+}
+
+// Draws a run with its first glyph's origin at x, y in a single request
+void fontlist_drawRun(fontlist* list, XftDraw* draw, XftColor* color, fontrun* run, int x, int y) {
+	if (run->n == 0)
+		return;
+	darray* specs = list->scratch;
+	darray_clear(specs);
+	darray_reserve(specs, run->n);
+	for (int i=0; i<run->n; i++) {
+		XftGlyphFontSpec spec = run->glyphs[i];
+		spec.x += x;
+		spec.y += y;
+		darray_addBack(specs, &spec);
+	}
+	XftDrawGlyphFontSpec(draw, color, (XftGlyphFontSpec*)specs->data, specs->size);
+}
+
+void fontlist_free(fontlist* list) {
+	fontlist_clearRuns(list);
+	free(list->runs);
+	darray_free(list->scratch);
+	for (int i=0; i<list->specs->size; i++)
+		free(DARRAY_AT(list->specs, char*, i));
+	darray_free(list->specs);
+	darray_free(list->fonts);
+	free(list->bmp);
+	wtable_free(list->astral);
+	free(list);
+}
@@ -0,0 +1,118 @@
+#include <pthread.h>
+
+// Fontconfig matching for the fonts of the first frame, on a worker
+// thread so it overlaps with fetching the window tree.  Matching mostly
+// means fontconfig loading its config and font cache, which the worker does
+// for a config of its own instead of the process wide default.  Only the
+// X side stays on the main thread: the display's defaults (dpi, antialias)
+// are read before the worker starts, and the matches are opened by
+// fontmatch_finish().  The worker substitutes in the order XftFontMatch()
+// does, config rules first and then the display's defaults, so it picks the
+// same fonts fontcache_open() would.  Specs already resolved on disk by an
+// earlier launch are left to fontcache_open(), and when that's all of them
+// no worker is started.
+
+typedef struct {
+	int n;
+	char** specs;         // not owned, the fontlists keep them
+	FcPattern** patterns; // what to match, spec at pixelsize
+	FcPattern** matches;  // filled in by the worker, NULL if nothing matched
+	FcPattern* defaults;  // what XftDefaultSubstitute() adds to an empty pattern
+	int pixelsize;
+	pthread_t thread;
+	char threaded;        // whether there's a thread to join
+} fontmatch;
+
+// The properties XftDefaultSubstitute() sets itself, before it hands over
+// to FcDefaultSubstitute()
+static const char* fontmatch_xftObjects[] = {
+	XFT_RENDER, FC_ANTIALIAS, FC_EMBOLDEN, FC_HINTING, FC_HINT_STYLE, FC_AUTOHINT,
+	FC_RGBA, FC_LCD_FILTER, FC_MINSPACE, FC_DPI, FC_SCALE, XFT_MAX_GLYPH_MEMORY,
+	XFT_MAX_UNREF_FONTS,
+};
+
+// XftDefaultSubstitute() without the display, from the values it gave before
+static void fontmatch_defaults(fontmatch* m, FcPattern* pattern) {
+	FcValue v;
+	for (int i=0; i<sizeof(fontmatch_xftObjects) / sizeof(fontmatch_xftObjects[0]); i++) {
+		const char* object = fontmatch_xftObjects[i];
+		if (FcPatternGet(pattern, object, 0, &v) == FcResultNoMatch &&
+				FcPatternGet(m->defaults, object, 0, &v) == FcResultMatch)
+			FcPatternAdd(pattern, object, v, FcTrue);
+	}
+	FcDefaultSubstitute(pattern);
+}
+
+static void* fontmatch_run(void* arg) {
+	fontmatch* m = arg;
+	FcConfig* config = FcInitLoadConfigAndFonts();
+	for (int i=0; i<m->n; i++) {
+		FcResult result;
+		m->matches[i] = NULL;
+		if (config == NULL)
+			continue;
+		FcConfigSubstitute(config, m->patterns[i], FcMatchPattern);
+		fontmatch_defaults(m, m->patterns[i]);
+		m->matches[i] = FcFontMatch(config, m->patterns[i], &result);
+	}
+	if (config != NULL)
+		FcConfigDestroy(config);
+	return NULL;
+}
+
+static void fontmatch_add(fontmatch* m, fontdisk* disk, char* spec) {
+	if (fontdisk_has(disk, spec, m->pixelsize))
+		return;
+	for (int i=0; i<m->n; i++) {
+		if (strcmp(m->specs[i], spec) == 0)
+			return;
+	}
+	int len = snprintf(NULL, 0, "%s:pixelsize=%d", spec, m->pixelsize);
+	char fontWithSize[len + 1];
+	sprintf(fontWithSize, "%s:pixelsize=%d", spec, m->pixelsize);
+	FcPattern* pattern = FcNameParse((FcChar8*)fontWithSize);
+	if (pattern == NULL)
+		return;
+	m->specs[m->n] = spec;
+	m->patterns[m->n] = pattern;
+	m->n++;
+}
+
+// Starts matching every spec of both chains at pixelsize that disk doesn't know
+fontmatch* fontmatch_start(Display* dpy, int screen, fontdisk* disk, darray* specs, darray* windowSpecs,
+		int pixelsize) {
+	int max = specs->size + windowSpecs->size;
+	fontmatch* m = malloc(sizeof(fontmatch));
+	m->n = 0;
+	m->specs = malloc((max + 1) * sizeof(char*));
+	m->patterns = malloc((max + 1) * sizeof(FcPattern*));
+	m->matches = malloc((max + 1) * sizeof(FcPattern*));
+	m->pixelsize = pixelsize;
+	m->defaults = FcPatternCreate();
+	XftDefaultSubstitute(dpy, screen, m->defaults);
+	for (int i=0; i<specs->size; i++)
+		fontmatch_add(m, disk, DARRAY_AT(specs, char*, i));
+	for (int i=0; i<windowSpecs->size; i++)
+		fontmatch_add(m, disk, DARRAY_AT(windowSpecs, char*, i));
+
+	m->threaded = m->n > 0 && pthread_create(&m->thread, NULL, fontmatch_run, m) == 0;
+	if (!m->threaded && m->n > 0)
+		fontmatch_run(m);
+	return m;
+}
+
+// Waits for the worker and opens what it matched into cache
+void fontmatch_finish(fontmatch* m, fontcache* cache, Display* dpy) {
+	if (m->threaded)
+		pthread_join(m->thread, NULL);
+	for (int i=0; i<m->n; i++) {
+		if (m->matches[i] != NULL)
+			fontcache_adopt(cache, dpy, m->specs[i], m->pixelsize, m->matches[i]);
+		FcPatternDestroy(m->patterns[i]);
+	}
+	free(m->specs);
+	free(m->patterns);
+	free(m->matches);
+	FcPatternDestroy(m->defaults);
+	free(m);
+}
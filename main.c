@@ -2,22 +2,44 @@
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h> // for tolower()
+#include <time.h> // for startup timings
 #include <X11/Xlib.h>
 #include <X11/Xutil.h>
 #include <X11/Xos.h>
 #include <X11/Xatom.h>
+#include <X11/Xproto.h> // request codes, for telling errors apart
 #include <X11/Xft/Xft.h>
 #include <fontconfig/fontconfig.h>
 #include "utf8.h"
-#include "llist.c"
+#include "atoms.c"
+#include "darray.c"
+#include "rectbatch.c"
+#include "arena.c"
+#include "wtable.c"
+#include "fontlist.c"
+#include "cachedir.c"
+#include "fontdisk.c"
+#include "fontcache.c"
+#include "fontmatch.c"
+#include "softrender.c"
+#include "thumbnails.c"
+#include "thumbcache.c"
 #include "config.c"
 #include "multihead.c"
+#include "batchfetch.c"
+#include "snapfile.c"
 
 #define NAV_NORMAL_SELECTION 1
 #define NAV_MOVE_WITH_SELECTION 2
 #define NAV_MOVE_WITH_SELECTION_EXPERIMENTAL 3
 
 char navType = NAV_NORMAL_SELECTION;
+int MARGIN = 2;
+char showTimings; // print how long each startup phase took
+
+#define RENDER_WINDOWS 0 // a child window and back buffer per workspace
+#define RENDER_SINGLE 1  // the whole grid in the main window
+#define RENDER_SOFTWARE 2 // the whole grid rasterized by us, shown with (Shm)PutImage
 
 typedef struct {
 	int workspace;
@@ -25,29 +47,59 @@ typedef struct {
 	int y;
 	int w;
 	int h;
+	int rx; // Geometry relative to the root, kept around so a resize
+	int ry; // only has to rescale instead of asking the server again
+	int rw;
+	int rh;
+	long state; // WM_STATE, 0 if the window manager hasn't set it
+	char override; // override-redirect windows are never previewed
+	char mapped;
+	char known; // properties have been read at least once
+	char previewed; // in the previews as of the last rebuildPreviews()
+	int previewedOn; // and on which workspace
+	int classId; // index of className in the class table, -1 if none, -2 if not looked up yet
 	char* className;
 	char* name;
 	unsigned long windowId;
 } MiniWindow;
 
+// The MiniWindows worth drawing, grouped by workspace and in stacking order
+// within each workspace.  The fields that every frame and every search
+// keystroke read are kept in parallel arrays, so those loops scan packed
+// memory instead of following a pointer per window.
+typedef struct {
+	int size;
+	int capacity;
+	int nBuckets;     // one per workspace, plus one for windows on desktops we don't show
+	int* bucketStart; // workspace i is [bucketStart[i], bucketStart[i+1]), nBuckets + 1 entries
+	int* workspace;
+	XRectangle* rect;    // scaled geometry within the workspace
+	int* classId;
+	MiniWindow** window; // everything else (titles, windowId)
+} PreviewSet;
+
 typedef struct {
 	unsigned long* pixels;
-	llist* fonts; // Fonts in fallback order
-	llist* wFonts; // Fonts for optional window text
+	fontlist* fonts; // Fonts in fallback order
+	fontlist* wFonts; // Fonts for optional window text
+	fontcache* fontCache; // Every font opened, shared by both lists
 	int nFonts;
 	XftColor* fontColor;
 	GC selected;
 	GC normal;
 	GC workspace;
 	GC matched;
+	rectbatch* batch;  // preview rectangles waiting to be drawn
+	darray* batchText; // int, previews whose text goes on top of the batch
 } GfxContext;
 
 typedef struct {
 	char* buffer;
-	unsigned short size;
+	int size;
+	int capacity; // bytes allocated for buffer, including the terminator
 	MiniWindow* selectedWindow; // pointer to the currently selected MiniWindow
-	MiniWindow** matchedWindows; // array of MiniWindows that match search filter
-	unsigned short nMatched;
+	darray* matchedWindows; // MiniWindow*, the previews that match search filter, in preview order
+	darray* classMatched; // char per classId, whether that class matches buffer
 	char* prefix; // a prefix string to indicate search mode is active
 } SearchContext;
 
@@ -58,24 +110,54 @@ typedef struct {
 	int height;	   
 } Sizing;
 
+#define LONG_BITS (8 * sizeof(unsigned long))
+
+// Work that is deferred until the event queue has been drained, so that
+// a burst of events costs one update and one redraw
+typedef struct {
+	char model;  // previews need to be refiltered from the stack
+	char layout; // the grid changed shape, workspace windows need moving and previews rescaling
+	char fonts;  // fonts need reopening at a new pixelsize
+	unsigned long* workspaces; // bitmap of workspaces that need repainting
+} Dirty;
+
 typedef struct {
-	llist* monitors;    // The list of connected Monitors
-	llist* previews;    // The list of MiniWindows
+	Atom* atoms;        // Interned once at startup, indexed by ATOM_*
+	char clientListMode; // 1 if the config allows enumerating from _NET_CLIENT_LIST_STACKING
+	char useClientList;  // the window manager passed probeClientList(), only clients are tracked
+	darray* monitors;   // The connected Monitors
+	darray* stack;      // MiniWindow* for every child of the root, in stacking order
+	wtable* windows;    // windowId -> MiniWindow for everything in stack
+	arena* snapshot;    // MiniWindows in stack and their strings are allocated here
+	arena* spare;       // the next snapshot is built here during a resync or compaction
+	size_t garbage;     // bytes in snapshot no longer used by a tracked window
+	PreviewSet* previews; // The MiniWindows in stack worth drawing
+	darray* classes;    // char*, every distinct className seen, indexed by classId
 	Window* workspaces; // array of desktops
 	char** workspaceNames; // names of workspaces (assumes same size and order as workspaces)
-	XftDraw** draws;  // XFT draw surface for strings. size == nWorkspaces
+	char renderer;    // RENDER_*
+	Pixmap* buffers;  // Back buffer per workspace, frames are drawn here and copied to the window.
+	                  // With RENDER_SINGLE there's only one, for the whole pager
+	XftDraw** draws;  // XFT draw surface for strings on each back buffer
+	softsurface* soft; // the frame with RENDER_SOFTWARE, which has no buffers or draws
+	thumbnails* thumbs; // live contents of mapped windows, NULL unless enabled
+	thumbcache* stills; // last seen contents of unmapped windows, NULL unless enabled
 	unsigned short nWorkspaces; // size of workspaces
 	int selected; // index of currently selected workspace
+	int currentDesktop; // the desktop the window manager says is current
+	char daemon; // resident, hides instead of exiting and shows again when launched
+	char hidden; // unmapped until the next launch, frames are drawn but not shown
 	SearchContext* search; // the current search string
 	char mode; // current mode of the pager.  0 - workspace, 1 - className search, 2 - ???
 	char windowTextMode; // 0 - no text, 1 - className, 2 - name/title
 	
 	int workspacesPerRow;
 	Window mainWindow; // for drawing the search string
+	Window pagerWindow; // our own top level window
 	Sizing* sizing;    // Information about the current size and scaling
 	GfxContext* gfx;
-	char* rawFont;			// TODO: refactor these somewhere more sensible
-	char* rawWindowFont;
+	Dirty* dirty;
+	int pixelsize;     // size the fonts are currently open at
 } Model;
 
 // TODO: how does control flow work here? Program keeps running 
@@ -87,6 +169,12 @@ int errorHandler(Display* dpy, XErrorEvent* event) {
 	// fatal errors for us, so we ignore them.
 	if (event->error_code == BadWindow) {
 		printf("BadWindow! \n");
+	} else if (event->request_code == X_SetInputFocus) {
+		// Our window isn't viewable yet after a desktop switch, not worth dying over
+		printf("Focus error %d\n", event->error_code);
+	} else if (thumbs_ownsError(event)) {
+		// Same thing for the thumbnail of a window that just went away
+		printf("Thumbnail error %d\n", event->error_code);
 	} else {
 		// Still cleanup and exit if we hit something else
 		printf("Other error %d\n", event->error_code);
@@ -96,28 +184,38 @@ int errorHandler(Display* dpy, XErrorEvent* event) {
 }
 
 // TODO: Move to a navigation file
-void setDesktopForWindow(Window win, int desktop) {
-	char command[50*sizeof(char)];
-	sprintf(command, "xdotool set_desktop_for_window %ld %d", win, desktop);
-	system(command);
+// Requests to the window manager go to the root as client messages (EWMH),
+// with 2 as the source indication since we're a pager.  Flushed right away,
+// the pager usually exits next without another round trip.
+void sendWmMessage(Display* dpy, Window w, Atom type, long l0, long l1) {
+	XEvent e;
+	memset(&e, 0, sizeof(e));
+	e.xclient.type = ClientMessage;
+	e.xclient.window = w;
+	e.xclient.message_type = type;
+	e.xclient.format = 32;
+	e.xclient.data.l[0] = l0;
+	e.xclient.data.l[1] = l1;
+	XSendEvent(dpy, DefaultRootWindow(dpy), False,
+			SubstructureRedirectMask | SubstructureNotifyMask, &e);
+	XFlush(dpy);
 }
 
-void activateWindow(Window win) {
-	char command[35*sizeof(char)];
-	sprintf(command, "xdotool windowactivate %ld", win);
-	system(command);
+void setDesktopForWindow(Display* dpy, Atom* atoms, Window win, int desktop) {
+	sendWmMessage(dpy, win, atoms[ATOM_NET_WM_DESKTOP], desktop, 2);
 }
 
-void switchDesktop(int desktop) {
-	char command[35*sizeof(char)];
-	sprintf(command, "xdotool set_desktop %d", desktop);
-	system(command);
+void activateWindow(Display* dpy, Atom* atoms, Window win) {
+	sendWmMessage(dpy, win, atoms[ATOM_NET_ACTIVE_WINDOW], 2, CurrentTime);
 }
 
-void grabFocus(Window win) {
-	char command[35*sizeof(char)];
-	sprintf(command, "xdotool windowfocus %ld", win);
-	system(command);
+void switchDesktop(Display* dpy, Atom* atoms, int desktop) {
+	sendWmMessage(dpy, DefaultRootWindow(dpy), atoms[ATOM_NET_CURRENT_DESKTOP], desktop, CurrentTime);
+}
+
+// Not something the window manager is asked for, a dock wouldn't get it
+void grabFocus(Display* dpy, Window win) {
+	XSetInputFocus(dpy, win, RevertToParent, CurrentTime);
 }
 
 // Has the pointer moved into a different child window than the current selection
@@ -131,178 +229,345 @@ int findPointerWorkspace(Window relative, Window workspaces[], unsigned int nWor
 	return -1;
 }
 
-void updateSearchContext(SearchContext* search, llist* previews) {
+// Keep the selection if it still matches, otherwise fall back to the
+// first match in the list (should be deterministic)
+void updateSearchSelection(SearchContext* search, MiniWindow* prevSelection) {
+	darray* matched = search->matchedWindows;
+	if (matched->size == 0) {
+		search->selectedWindow = NULL;
+	} else if (prevSelection == NULL || darray_indexOf(matched, prevSelection) < 0) {
+		search->selectedWindow = DARRAY_AT(matched, MiniWindow*, 0);
+	}
+}
+
+// Rematch every preview against the whole buffer.  Needed whenever the
+// previews change or the buffer gets shorter.
+void updateSearchContext(SearchContext* search, PreviewSet* previews, darray* classes) {
 	MiniWindow* prevSelection = search->selectedWindow;
 
-	search->nMatched = 0;
-	char found = 0;
-	node* ptr = previews->head;
+	// Compare each distinct class once rather than once per window
+	darray_reserve(search->classMatched, classes->size);
+	search->classMatched->size = classes->size;
+	for (int c=0; c<classes->size; ++c) {
+		char* className = DARRAY_AT(classes, char*, c);
+		DARRAY_AT(search->classMatched, char, c) = strncmp(className,search->buffer,search->size) == 0;
+	}
+
+	darray* matched = search->matchedWindows;
+	darray_clear(matched);
+	darray_reserve(matched, previews->size);
 	for(int i=0; i<previews->size; ++i) {
-		MiniWindow* mw = ptr->data;
-		if (strncmp(mw->className,search->buffer,search->size) == 0) {
-			search->matchedWindows[search->nMatched++] = mw;
-			if (prevSelection == mw) {
-				found = True; // previous selection still matches, keep it selected
-			}
-		}
-		ptr = ptr->next;
+		int classId = previews->classId[i];
+		if (classId >= 0 && DARRAY_AT(search->classMatched, char, classId))
+			darray_addBack(matched, &previews->window[i]);
 	}
-	// Use the first match in the list (should be deterministic) if we don't already have a selection
-	if (!found && search->nMatched > 0) {
-		search->selectedWindow = search->matchedWindows[0];
+	updateSearchSelection(search, prevSelection);
+}
+
+// The buffer just grew by one character, so the new matches are a subset of
+// the old ones: only classes that matched before need their new last
+// character checked, and only windows that matched before are refiltered.
+void narrowSearchContext(SearchContext* search, darray* classes) {
+	MiniWindow* prevSelection = search->selectedWindow;
+	int last = search->size - 1;
+	char c = search->buffer[last];
+
+	for (int i=0; i<search->classMatched->size; ++i) {
+		char* match = &DARRAY_AT(search->classMatched, char, i);
+		// The first size-1 characters already matched, so className is at least that long
+		if (*match)
+			*match = DARRAY_AT(classes, char*, i)[last] == c;
 	}
-	if (search->nMatched == 0) {
-		search->selectedWindow = NULL;
+
+	darray* matched = search->matchedWindows;
+	int n = 0;
+	for (int i=0; i<matched->size; ++i) {
+		MiniWindow* mw = DARRAY_AT(matched, MiniWindow*, i);
+		// A class that changed since the last rematch isn't resolved yet
+		if (mw->classId >= 0 && mw->classId < search->classMatched->size &&
+				DARRAY_AT(search->classMatched, char, mw->classId))
+			DARRAY_AT(matched, MiniWindow*, n++) = mw;
 	}
+	matched->size = n;
+	updateSearchSelection(search, prevSelection);
 }
 
-void drawUtfText(Display* dpy, XftDraw* draw, llist* fonts, XftColor* color, int x, int y,
+// Draws text (len bytes of utf8) at x, y, cut off before it gets wider than w
+// (no limit if negative).  Each glyph comes from the first font that has it.
+void drawUtfText(Display* dpy, XftDraw* draw, fontlist* fonts, XftColor* color, int x, int y,
 		char* text, int len, int w) {
+	fontrun* run = fontlist_run(fonts, dpy, text, len, w);
+	fontlist_drawRun(fonts, draw, color, run, x, y);
+}
 
-	int err, tw = 0;
-	char *t, *next;
-	unsigned int rune;
-	XftFont* f;
-	XGlyphInfo ext;
-
-	for (t=text; t - text < len; t = next) {
-		next = utf8_decode(t, &rune, &err);
-		node* ptr = fonts->head;
-		while (ptr != NULL) {
-			XftFont* font = ptr->data;
-			if (XftCharExists(dpy, font ,rune)) {
-				f = font;
-				break;
-			}
-			ptr = ptr->next;
-		}
-		if (ptr != NULL) {
-			XftTextExtentsUtf8(dpy,f,(XftChar8*)t, next - t, &ext);
-			tw += ext.xOff;
-			if (w >= 0 && tw >= w) {
-				break;
-			}
-			XftDrawStringUtf8(draw, color, f, x, y, (XftChar8*)t, next-t);
-			x += ext.xOff;
-		} else {
-			fprintf(stderr,"char %s not in fonts\n", next);
-		}
+// Fonts scale with the size of a preview cell
+int fontPixelsize(Sizing* s) {
+	int minDimension = s->previewHeight < s->previewWidth ? 
+		s->previewHeight : s->previewWidth;
+	return minDimension / 9;
+}
+
+char isWorkspaceDirty(Model* model, int workspace) {
+	return (model->dirty->workspaces[workspace / LONG_BITS] >> (workspace % LONG_BITS)) & 1;
+}
+
+// Restricts every GC drawing previews to a cell of the single surface, or
+// lifts the restriction again if clip is NULL
+void clipPreviewGCs(Display* dpy, GfxContext* colorsCtx, XRectangle* clip) {
+	GC gcs[] = {colorsCtx->normal, colorsCtx->selected, colorsCtx->workspace, colorsCtx->matched};
+	for (int i=0; i<4; i++) {
+		if (clip)
+			XSetClipRectangles(dpy, gcs[i], 0, 0, clip, 1, YXBanded);
+		else
+			XSetClipMask(dpy, gcs[i], None);
+	}
+}
+
+// Where a workspace gets drawn.  With a window per workspace that's the
+// workspace's own back buffer, with a single surface it's the workspace's
+// part of the one back buffer of the whole pager.
+typedef struct {
+	Drawable drawable;
+	XftDraw* draw;
+	int x; // offset of the cell in drawable
+	int y;
+} Cell;
+
+// Top left corner of workspace i in the pager's grid
+void cellOrigin(Model* m, int i, int* x, int* y) {
+	int xoff = i % m->workspacesPerRow;
+	int yoff = i / m->workspacesPerRow;
+	*x = (xoff * m->sizing->previewWidth) + ((xoff+1) * MARGIN);
+	*y = (yoff * m->sizing->previewHeight) + ((yoff+1) * MARGIN);
+}
+
+Cell workspaceCell(Model* m, int i) {
+	Cell c;
+	if (m->renderer == RENDER_SOFTWARE) {
+		c.drawable = None;
+		c.draw = NULL;
+		cellOrigin(m, i, &c.x, &c.y);
+	} else if (m->renderer == RENDER_SINGLE) {
+		c.drawable = m->buffers[0];
+		c.draw = m->draws[0];
+		cellOrigin(m, i, &c.x, &c.y);
+	} else {
+		c.drawable = m->buffers[i];
+		c.draw = m->draws[i];
+		c.x = 0;
+		c.y = 0;
+	}
+	return c;
+}
+
+// Draws text at x, y of a cell, like drawUtfText()
+void drawCellText(Display* dpy, Model* m, Cell* c, fontlist* fonts, int x, int y, char* text, int len, int w) {
+	XftColor* color = m->gfx->fontColor;
+	if (m->renderer == RENDER_SOFTWARE)
+		soft_drawRun(m->soft, fontlist_run(fonts, dpy, text, len, w), c->x + x, c->y + y, color->pixel);
+	else
+		drawUtfText(dpy, c->draw, fonts, color, c->x + x, c->y + y, text, len, w);
+}
+
+void drawPreviewText(Display* dpy, Model* m, GfxContext* colorsCtx, Cell* c, int i, int pixelsize) {
+	XRectangle r = m->previews->rect[i];
+	MiniWindow* mw = m->previews->window[i];
+	switch (m->windowTextMode) {
+		case 0: break; // No window text
+		case 1: 
+			if (mw->className)
+			drawCellText(dpy, m, c, colorsCtx->wFonts, 
+				r.x, r.y+pixelsize, mw->className, strlen(mw->className), r.width);
+			break;
+		case 2:
+			if (mw->name)
+			drawCellText(dpy, m, c, colorsCtx->wFonts, 
+				r.x, r.y+pixelsize, mw->name, strlen(mw->name), r.width);
+			break;
+	}
+}
 
+// Draw the batched previews of a workspace, then their text
+void flushPreviews(Display* dpy, Model* m, GfxContext* colorsCtx, Cell* c, int pixelsize) {
+	if (m->renderer == RENDER_SOFTWARE)
+		soft_flushBatch(m->soft, colorsCtx->batch);
+	else
+		rectbatch_flush(colorsCtx->batch, dpy, c->drawable);
+	for (int k=0; k<colorsCtx->batchText->size; k++)
+		drawPreviewText(dpy, m, colorsCtx, c, DARRAY_AT(colorsCtx->batchText, int, k), pixelsize);
+	darray_clear(colorsCtx->batchText);
+}
+
+// Shows workspace i by copying its back buffer, or the given part of it
+// (relative to the workspace)
+void presentWorkspace(Display* dpy, Model* m, int i, int x, int y, int w, int h) {
+	if (m->renderer == RENDER_SOFTWARE) {
+		int cx, cy;
+		cellOrigin(m, i, &cx, &cy);
+		soft_present(m->soft, m->pagerWindow, m->gfx->workspace, cx + x, cy + y, w, h);
+	} else if (m->renderer == RENDER_SINGLE) {
+		int cx, cy;
+		cellOrigin(m, i, &cx, &cy);
+		XCopyArea(dpy, m->buffers[0], m->pagerWindow, m->gfx->workspace, cx + x, cy + y, w, h, cx + x, cy + y);
+	} else {
+		XCopyArea(dpy, m->buffers[i], m->workspaces[i], m->gfx->workspace, x, y, w, h, x, y);
 	}
 }
 
+// Repaints only the workspaces marked dirty since the last flush.  Each one
+// is drawn into its back buffer and shown in one copy, so a half-drawn
+// frame never reaches the screen.
 void redraw(Display *dpy, int screen, int margin, GfxContext* colorsCtx, Model* m) {
 	unsigned short nWorkspaces = m->nWorkspaces;
-	llist* previews = m->previews;
+	PreviewSet* previews = m->previews;
 	SearchContext* search = m->search;
-	Window* workspaces = m->workspaces;
 	int selected = m->selected;
+	Sizing* s = m->sizing;
+
+	// Window text offset based on pixelsize of fonts
+	int pixelsize = fontPixelsize(m->sizing);
+
+	if (m->renderer == RENDER_SOFTWARE)
+		soft_begin(m->soft);
 
 	int i=0;
-	// Quick clear of all child windows to cleanup selected border
-	// Background is reset in case selected has changed
-	for(i=0;i<nWorkspaces;++i) {
-		long pixel = colorsCtx->pixels[2]; // default bg
-		if (m->mode == 0 && i == selected) {
-			pixel = colorsCtx->pixels[0]; // selected workspace in workspace mode
+	for(int workspace=0; workspace<nWorkspaces; ++workspace) {
+		if (!isWorkspaceDirty(m, workspace))
+			continue;
+		Cell c = workspaceCell(m, workspace);
+		Picture thumbTarget = None; // created for the first thumbnail in the cell
+		XRectangle bounds = {c.x, c.y, s->previewWidth, s->previewHeight};
+		// A workspace window clips for us, a cell of the single surface doesn't
+		if (m->renderer == RENDER_SINGLE) {
+			clipPreviewGCs(dpy, colorsCtx, &bounds);
+			XftDrawSetClipRectangles(c.draw, 0, 0, &bounds, 1);
+		} else if (m->renderer == RENDER_SOFTWARE) {
+			soft_setClip(m->soft, bounds);
 		}
-		XSetWindowBackground(dpy, workspaces[i], pixel);
-		XClearWindow(dpy,workspaces[i]);
-	}
 
-	// Window text offset based on pixelsize of fonts
-	int minDimension = m->sizing->previewHeight < m->sizing->previewWidth ? 
-		m->sizing->previewHeight : m->sizing->previewWidth;
-	int pixelsize = minDimension / 9;
-
-	// Draw windows.  Note that order should be stacking order to ensure floating windows are drawn correctly
-	node* ptr = previews->head;
-	for(i=0; i< previews->size; ++i) {
-		MiniWindow mw = *(MiniWindow *)ptr->data;
-		if (mw.workspace < nWorkspaces) {
+		// Clear the cell to cleanup selected border
+		// Background depends on whether the workspace is selected
+		GC bg = colorsCtx->workspace; // default bg
+		if (m->mode == 0 && workspace == selected) {
+			bg = colorsCtx->selected; // selected workspace in workspace mode
+		}
+		if (m->renderer == RENDER_SOFTWARE)
+			soft_fillGC(m->soft, bounds.x, bounds.y, bounds.width, bounds.height, bg);
+		else
+			XFillRectangle(dpy, c.drawable, bg, bounds.x, bounds.y, bounds.width, bounds.height);
+
+		// Draw windows.  Note that order should be stacking order to ensure floating windows are drawn correctly.
+		// Previews are batched per GC and a batch is only drawn once the next
+		// preview would overlap it, so a tiled workspace goes out in a handful of requests.
+		for(i=previews->bucketStart[workspace]; i<previews->bucketStart[workspace+1]; ++i) {
+			XRectangle r = previews->rect[i];
 			GC fillGC = colorsCtx->normal;
 			GC outlineGC = colorsCtx->workspace;
 			if (m->mode == 1 && search->size > 0) {
-				if (ptr->data == search->selectedWindow) {
+				int classId = previews->classId[i];
+				if (previews->window[i] == search->selectedWindow) {
 					fillGC = colorsCtx->selected;
 					outlineGC = colorsCtx->matched;
-				} else if (strncmp(mw.className,search->buffer,search->size) == 0) {
+				} else if (classId >= 0 && DARRAY_AT(search->classMatched, char, classId)) {
 					outlineGC = colorsCtx->selected;	
 				}
 
-			} else if (m->mode == 0 && mw.workspace == selected) {
+			} else if (m->mode == 0 && workspace == selected) {
 				// Outline windows on the selected workspace in workspace mode
 				// This lets us see floating windows
 				outlineGC = colorsCtx->selected;
 			}
 
-			//printf("drawing rect %d (%d %d %d %d)\n",mw->workspace,mw->x,mw->y,mw->w,mw->h);
-			XFillRectangle(dpy, workspaces[mw.workspace], fillGC, mw.x,mw.y,mw.w,mw.h);
-			XDrawRectangle(dpy, workspaces[mw.workspace], outlineGC, mw.x,mw.y,mw.w,mw.h);
-
-			// draw title text
-			switch (m->windowTextMode) {
-				case 0: break; // No window text
-				case 1: 
-					if (mw.className)
-					drawUtfText(dpy, m->draws[mw.workspace], colorsCtx->wFonts, 
-						colorsCtx->fontColor, 
-						mw.x, mw.y+pixelsize, mw.className, strlen(mw.className), mw.w);
-					break;
-				case 2:
-					if (mw.name)
-					drawUtfText(dpy, m->draws[mw.workspace], colorsCtx->wFonts, 
-						colorsCtx->fontColor, 
-						mw.x, mw.y+pixelsize, mw.name, strlen(mw.name), mw.w);
-					break;
+			//printf("drawing rect %d (%d %d %d %d)\n",workspace,r.x,r.y,r.width,r.height);
+			r.x += c.x;
+			r.y += c.y;
+			thumbnail* th = m->thumbs ? thumbs_get(m->thumbs, previews->window[i]->windowId) : NULL;
+			if (th != NULL) {
+				// Drawn right away, after everything queued below it
+				flushPreviews(dpy, m, colorsCtx, &c, pixelsize);
+				if (thumbTarget == None) {
+					thumbTarget = XRenderCreatePicture(dpy, c.drawable, m->thumbs->dstFormat, 0, NULL);
+					if (m->renderer == RENDER_SINGLE)
+						XRenderSetPictureClipRectangles(dpy, thumbTarget, 0, 0, &bounds, 1);
+				}
+				thumbs_draw(m->thumbs, th, thumbTarget, r.x, r.y, r.width, r.height,
+						previews->window[i]->rw, previews->window[i]->rh);
+				XDrawRectangle(dpy, c.drawable, outlineGC, r.x, r.y, r.width, r.height);
+				drawPreviewText(dpy, m, colorsCtx, &c, i, pixelsize);
+				continue;
 			}
+			thumbstill* still = m->stills ? thumbcache_get(m->stills, previews->window[i]->windowId) : NULL;
+			if (still != NULL) {
+				flushPreviews(dpy, m, colorsCtx, &c, pixelsize);
+				thumbcache_draw(m->stills, still, c.drawable, fillGC, r.x, r.y, r.width, r.height);
+				XDrawRectangle(dpy, c.drawable, outlineGC, r.x, r.y, r.width, r.height);
+				drawPreviewText(dpy, m, colorsCtx, &c, i, pixelsize);
+				continue;
+			}
+			if (rectbatch_overlaps(colorsCtx->batch, r))
+				flushPreviews(dpy, m, colorsCtx, &c, pixelsize);
+			rectbatch_add(colorsCtx->batch, r, fillGC, outlineGC);
+			if (m->windowTextMode != 0)
+				darray_addBack(colorsCtx->batchText, &i);
+		}
+		flushPreviews(dpy, m, colorsCtx, &c, pixelsize);
+		if (thumbTarget != None)
+			XRenderFreePicture(dpy, thumbTarget);
+
+		// Draw workspace label
+		if (m->workspaceNames[workspace] != NULL) {
+			drawCellText(dpy, m, &c, colorsCtx->fonts, 5, s->previewHeight-10,
+					m->workspaceNames[workspace], strlen(m->workspaceNames[workspace]), -1);
 		}
-		ptr = ptr->next;
-	}
 
-	// Draw workspace labels
-	for(i=0; i<nWorkspaces; ++i) {
-		if (m->workspaceNames[i] != NULL) {
-			drawUtfText(dpy, m->draws[i], colorsCtx->fonts, colorsCtx->fontColor, 5, m->sizing->previewHeight-10,
-					m->workspaceNames[i], strlen(m->workspaceNames[i]), -1);
+		// TODO: customize where search string is drawn
+		// Draw search string after everything to ensure it's on top
+		if (m->mode == 1 && workspace == 0) {
+			int prefixLen = strlen(search->prefix);
+			char sstring[search->size+prefixLen+1];
+			strcpy(sstring, search->prefix);
+			strcat(sstring,search->buffer);
+			drawCellText(dpy, m, &c, colorsCtx->fonts, 10, 20+pixelsize,
+				sstring, search->size + prefixLen, -1);
 		}
 	}
 
-	// TODO: customize where search string is drawn
-	// Draw search string after everything to ensure it's on top
-	if (m->mode == 1) {
-		int prefixLen = strlen(search->prefix);
-		char sstring[search->size+prefixLen];
-		strcpy(sstring, search->prefix);
-		strcat(sstring,search->buffer);
-		drawUtfText(dpy, m->draws[0], colorsCtx->fonts, colorsCtx->fontColor, 10,20+pixelsize,
-			sstring, search->size + prefixLen, -1);
+	// The copies below use these GCs too
+	if (m->renderer == RENDER_SINGLE)
+		clipPreviewGCs(dpy, colorsCtx, NULL);
+
+	// Shown by the Exposes of the next map instead
+	if (m->hidden)
+		return;
+	for(i=0; i<nWorkspaces; ++i) {
+		if (isWorkspaceDirty(m, i))
+			presentWorkspace(dpy, m, i, 0, 0, s->previewWidth, s->previewHeight);
 	}
 }
 
 
-void setTitle(Display* dpy, Window w) {
+void setTitle(Display* dpy, Atom* atoms, Window w) {
 	char* title = "XDPager";
 	XChangeProperty(dpy, w, 
-			XInternAtom(dpy, "_NET_WM_NAME", False),
-			XInternAtom(dpy, "UTF8_STRING", False),
+			atoms[ATOM_NET_WM_NAME],
+			atoms[ATOM_UTF8_STRING],
 			8, PropModeReplace, (unsigned char*)title, strlen(title));
 }
 
-void setDock(Display* dpy, Window w, XDConfig* cfg) {
+void setDock(Display* dpy, Atom* atoms, Window w, XDConfig* cfg) {
 	
-	Atom cardinal = XInternAtom(dpy,"CARDINAL",False);
+	Atom cardinal = XA_CARDINAL;
 	unsigned long allDesktops = 0xFFFFFFFF;
 	XChangeProperty(dpy, w,
-			XInternAtom(dpy, "_NET_WM_DESKTOP", False),
+			atoms[ATOM_NET_WM_DESKTOP],
 			cardinal,
 			32, PropModeReplace, (unsigned char*)&allDesktops, 1);
 
 
-	Atom dock = XInternAtom(dpy, "_NET_WM_WINDOW_TYPE_DOCK", False);
+	Atom dock = atoms[ATOM_NET_WM_WINDOW_TYPE_DOCK];
 	XChangeProperty(dpy, w,
-			XInternAtom(dpy, "_NET_WM_WINDOW_TYPE", False),
-			XInternAtom(dpy, "ATOM", False),
+			atoms[ATOM_NET_WM_WINDOW_TYPE],
+			XA_ATOM,
 			32, PropModeReplace,
 			(unsigned char*)&dock, 1);
 
@@ -328,20 +593,19 @@ void setDock(Display* dpy, Window w, XDConfig* cfg) {
 		}
 	}
 	XChangeProperty(dpy, w,
-			XInternAtom(dpy, "_NET_WM_STRUT", False),
+			atoms[ATOM_NET_WM_STRUT],
 			cardinal,
 			32, PropModeReplace, (unsigned char*)insets, 4);
 
 	XChangeProperty(dpy, w,
-			XInternAtom(dpy, "_NET_WM_STRUT_PARTIAL", False),
+			atoms[ATOM_NET_WM_STRUT_PARTIAL],
 			cardinal,
 			32, PropModeReplace, (unsigned char*)insets, 12);
 
 
 }
 
-int MARGIN = 2;
-Window createMainWindow(Display *dpy, int screen, unsigned short nWorkspaces, unsigned short workspacesPerRow,
+Window createMainWindow(Display *dpy, int screen, Atom* atoms, unsigned short nWorkspaces, unsigned short workspacesPerRow,
 		XDConfig* cfg) {
 	// This code was written with 16:9 2560x1440 monitors
 	int xPos = cfg->x;
@@ -371,19 +635,21 @@ Window createMainWindow(Display *dpy, int screen, unsigned short nWorkspaces, un
 	XSetClassHint(dpy, win, classHint);
 	XFree(classHint);
 
-	setTitle(dpy, win);
+	setTitle(dpy, atoms, win);
 	if (cfg->dockType)
-		setDock(dpy, win, cfg);
+		setDock(dpy, atoms, win, cfg);
 
 	XSelectInput(dpy, win, ExposureMask | KeyPressMask | ButtonPressMask | ButtonReleaseMask);
-	XMapWindow(dpy, win);
+	// A daemon waits to be launched before showing up
+	if (!cfg->daemon)
+		XMapWindow(dpy, win);
 
 	return win;
 }
 
-int getCurrentDesktop(Display* dpy) {
-	Atom prop = XInternAtom(dpy,"_NET_CURRENT_DESKTOP",False);
-	Atom cardinal = XInternAtom(dpy,"CARDINAL",False);
+int getCurrentDesktop(Display* dpy, Atom* atoms) {
+	Atom prop = atoms[ATOM_NET_CURRENT_DESKTOP];
+	Atom cardinal = XA_CARDINAL;
 	Atom actualType;
 	int format;
 	unsigned long nitems;
@@ -400,7 +666,7 @@ int getCurrentDesktop(Display* dpy) {
 	return -1;
 }
 
-char* getStringProp(Display* dpy, Window w, Atom prop, Atom type) {
+char* getStringProp(Display* dpy, arena* a, Window w, Atom prop, Atom type) {
 	Atom actualType;
 	int format;
 	unsigned long nitems;
@@ -410,19 +676,16 @@ char* getStringProp(Display* dpy, Window w, Atom prop, Atom type) {
 			0,100,False,type,
 			&actualType,&format,&nitems,&bytesAfter, &value);
 	if (value) {
-		char* result = malloc(nitems*sizeof(char) + 1);
-		if (result == NULL)
-			puts("uh oh getStringProp");
-		strcpy(result,(char*)value);
+		char* result = arena_strndup(a, (char*)value, strnlen((char*)value, nitems));
 		XFree(value);
 		return result;
 	}
 	return NULL;
 }
 
-int getWmDesktop(Display* dpy, Window w) {
-	Atom prop = XInternAtom(dpy,"_NET_WM_DESKTOP",False);
-	Atom cardinal = XInternAtom(dpy,"CARDINAL",False);
+int getWmDesktop(Display* dpy, Atom* atoms, Window w) {
+	Atom prop = atoms[ATOM_NET_WM_DESKTOP];
+	Atom cardinal = XA_CARDINAL;
 	Atom actualType;
 	int format;
 	unsigned long nitems;
@@ -461,14 +724,14 @@ Atom* getAtomProp(Display* dpy, Window w, Atom prop, int* return_nitems) {
 	return NULL;
 }
 
-char* getWmName(Display* dpy, Window w) {
-	Atom prop = XInternAtom(dpy,"_NET_WM_NAME",False);
-	Atom utf8String = XInternAtom(dpy,"UTF8_STRING",False);
-	return getStringProp(dpy, w, prop, utf8String);
+char* getWmName(Display* dpy, Atom* atoms, arena* a, Window w) {
+	Atom prop = atoms[ATOM_NET_WM_NAME];
+	Atom utf8String = atoms[ATOM_UTF8_STRING];
+	return getStringProp(dpy, a, w, prop, utf8String);
 }
 
-char* getClassName(Display* dpy, Window w) {
-	Atom prop = XInternAtom(dpy,"WM_CLASS",False);
+char* getClassName(Display* dpy, arena* a, Window w) {
+	Atom prop = XA_WM_CLASS;
 	Atom actualType;
 	int format;
 	unsigned long nitems;
@@ -478,15 +741,13 @@ char* getClassName(Display* dpy, Window w) {
 			0,100,False,AnyPropertyType,
 			&actualType,&format,&nitems,&bytesAfter, &value);
 	if (value) {
+		// WM_CLASS is "instance\0class\0", sized by the property length
 		char* result = NULL;
 		char* instance = (char*)value;
-		char* className = instance + strlen(instance) + 1;
-		if (className - instance < nitems)  {
-			// save one iteration by hardcoding a max size
-			result = malloc(30 * sizeof(char));
-			if (result == NULL)
-				puts("Uh oh getClassName");
-			strcpy(result,className);
+		size_t instanceLen = strnlen(instance, nitems);
+		if (instanceLen + 1 < nitems)  {
+			char* className = instance + instanceLen + 1;
+			result = arena_strndup(a, className, strnlen(className, nitems - instanceLen - 1));
 		}
 		XFree(value);
 		return result;
@@ -494,8 +755,8 @@ char* getClassName(Display* dpy, Window w) {
 	return NULL;
 }
 
-long getWmState(Display* dpy, Window w, int* return_nitems) {
-	Atom prop = XInternAtom(dpy,"WM_STATE",False);
+long getWmState(Display* dpy, Atom* atoms, Window w, int* return_nitems) {
+	Atom prop = atoms[ATOM_WM_STATE];
 	Atom actualType;
 	int format;
 	unsigned long nitems;
@@ -513,19 +774,19 @@ long getWmState(Display* dpy, Window w, int* return_nitems) {
 	return 0;
 }
 
-MiniWindow* makeMiniWindow(int workspace, int x, int y, int width, int height, 
-		char* className, char* name, Window window, Sizing* sizing, llist* monitors) {
+// Scales a window's root geometry down to its preview cell
+void scaleMiniWindow(MiniWindow* mw, Sizing* sizing, darray* monitors) {
 
-	double s_x, s_y; // Scale factors based on monitor resolution
+	int x = mw->rx;
+	int y = mw->ry;
+	double s_x = 1, s_y = 1; // Scale factors based on monitor resolution
 
 	// With the set of Monitors, we can construct ranges to determine 
 	// which monitor a window is on.  The monitor's offset is used to
 	// normalize the window coordinates to (0,0) and to scale it
 	//
-	node* ptr =  monitors->head;
-	Monitor* mtr;
-	while (ptr != NULL) {
-		mtr = ptr->data;
+	for (int i=0; i<monitors->size; i++) {
+		Monitor* mtr = &DARRAY_AT(monitors, Monitor, i);
 		int left_x = mtr->x_offset;
 		int right_x = left_x + mtr->width;
 		int top_y = mtr->y_offset;
@@ -535,74 +796,229 @@ MiniWindow* makeMiniWindow(int workspace, int x, int y, int width, int height,
 			s_x = ((double)mtr->width) / sizing->previewWidth;
 			s_y = ((double)mtr->height) / sizing->previewHeight;
 			// DEBUGGING INFO
-			// printf("Window %s is on monitor %d %d\n", className, mtr->x_offset, mtr->y_offset);
-			// printf("%s (%d,%d) -> (%d,%d) %d %f %f\n", className, x,y, x-mtr->x_offset, y-mtr->y_offset, sizing->previewWidth, s_x, s_y);
+			// printf("Window %s is on monitor %d %d\n", mw->className, mtr->x_offset, mtr->y_offset);
+			// printf("%s (%d,%d) -> (%d,%d) %d %f %f\n", mw->className, x,y, x-mtr->x_offset, y-mtr->y_offset, sizing->previewWidth, s_x, s_y);
 			x -= mtr->x_offset;
 			y -= mtr->y_offset;
 			break;
 		}
-		ptr = ptr->next;
 	}
 	// TODO: Edge cases
 	// 1. window origin is offscreen (coordinates not on any monitor)
 	//    Consider only the visible rectangle
 	// 2. window spans multiple monitors
 	//    Break apart into multiple MiniWindows linked together?
-	
-
-	// destructive but who cares
-	for(char* p=className; *p; p++) *p = tolower(*p);
 
 	// Scale factor is divisor
-	MiniWindow* mw = malloc(sizeof(MiniWindow));
-	mw->workspace = workspace;
 	mw->x = x / s_x;
 	mw->y = y / s_y;
-	mw->w = width / s_x;
-	mw->h = height / s_y;
-	mw->className = className;
-	mw->name = name;
+	mw->w = mw->rw / s_x;
+	mw->h = mw->rh / s_y;
+}
+
+MiniWindow* makeMiniWindow(arena* a, int x, int y, int width, int height, Bool override,
+		Window window, Sizing* sizing, darray* monitors) {
+
+	MiniWindow* mw = arena_alloc(a, sizeof(MiniWindow));
+	mw->workspace = -1;
+	mw->rx = x;
+	mw->ry = y;
+	mw->rw = width;
+	mw->rh = height;
+	mw->state = 0;
+	mw->override = override;
+	mw->mapped = 0;
+	mw->known = 0;
+	mw->previewed = 0;
+	mw->previewedOn = -1;
+	mw->classId = -2;
+	mw->className = NULL;
+	mw->name = NULL;
 	mw->windowId = window;
+	scaleMiniWindow(mw, sizing, monitors);
 
 	return mw;
 }
 
-llist* testX(Display* dpy, Sizing* sizing, llist* monitors) {
+// destructive but who cares
+void lowercase(char* str) {
+	if (str)
+		for(char* p=str; *p; p++) *p = tolower(*p);
+}
+
+// The string's bytes stay in the snapshot arena until the next compaction
+void retireString(Model* model, char* str) {
+	if (str)
+		model->garbage += strlen(str) + 1;
+}
+
+// (Re)reads the properties that decide whether and where a window is previewed
+void fetchWindowProps(Display* dpy, Model* model, MiniWindow* mw) {
+	Atom* atoms = model->atoms;
+	retireString(model, mw->className);
+	retireString(model, mw->name);
+
+	Window w = mw->windowId;
+	mw->name = getWmName(dpy, atoms, model->snapshot, w);
+	mw->className = getClassName(dpy, model->snapshot, w);
+	mw->classId = -2;
+	int nitems = 0;
+	mw->state = getWmState(dpy, atoms, w, &nitems);
+	mw->workspace = getWmDesktop(dpy, atoms, w);
+	mw->known = 1;
+
+	lowercase(mw->className);
+}
+
+// Asks the server about a single root child. Returns NULL if the window
+// was destroyed before we got to it.
+MiniWindow* fetchMiniWindow(Display* dpy, Model* model, Window w) {
+	XWindowAttributes wattr;
+	if (!XGetWindowAttributes(dpy, w, &wattr))
+		return NULL;
+
+	MiniWindow* mw = makeMiniWindow(model->snapshot, wattr.x, wattr.y, wattr.width, wattr.height,
+			wattr.override_redirect, w, model->sizing, model->monitors);
+	mw->mapped = wattr.map_state != IsUnmapped;
+	// The window manager never sets WM_STATE on override-redirect windows
+	// (menus, tooltips) so don't bother asking
+	if (!mw->override)
+		fetchWindowProps(dpy, model, mw);
+	return mw;
+}
+
+char isPreviewable(MiniWindow* mw) {
+	return mw->state != 0 && mw->workspace != -1;
+}
+
+// Builds MiniWindows for the given windows with a single batched fetch,
+// skipping any that were destroyed before we got to them
+darray* fetchMiniWindows(Display* dpy, Atom* atoms, arena* snapshot, Window* windows, int n,
+		Sizing* sizing, darray* monitors) {
+	darray* miniWindows = darray_create(sizeof(MiniWindow*));
+	darray_reserve(miniWindows, n);
+	WindowInfo* infos = fetchWindowInfos(dpy, atoms, snapshot, windows, n);
+	
+	for (int a=0; a < n; a++) {
+		WindowInfo* info = &infos[a];
+		if (!info->valid) {
+			// Destroyed before we got to it, DestroyNotify is on its way
+			continue;
+		}
+	//	printf("%d %d %d %d %d %s %s 0x%lx\n",info->desktop, 
+	//		info->x, info->y, info->width, info->height, 
+	//		info->className, info->name, windows[a]);
+		MiniWindow* mw = makeMiniWindow(snapshot, info->x, info->y, info->width, info->height,
+				info->override, windows[a], sizing, monitors);
+		mw->mapped = info->mapped;
+		// The window manager never sets WM_STATE on override-redirect windows
+		// so there's nothing to keep for them
+		if (!mw->override) {
+			mw->state = info->state;
+			mw->workspace = info->desktop;
+			mw->className = info->className;
+			mw->name = info->name;
+			mw->known = 1;
+			lowercase(mw->className);
+		}
+		darray_addBack(miniWindows,&mw);
+	}
+	free(infos);
+
+	return miniWindows;
+}
+
+// Returns every child of the root in stacking order (bottom first), 
+// including the ones that aren't worth previewing
+darray* testX(Display* dpy, Atom* atoms, arena* snapshot, Sizing* sizing, darray* monitors) {
 	Window root;
 	Window parent;
 	Window *children;
 	unsigned int nchildren;
 	XQueryTree(dpy, DefaultRootWindow(dpy), &root, &parent, &children, &nchildren);
 
-	llist* miniWindows = llist_create();
-	
-	for (int a=0; a < nchildren; a++) {
-		XWindowAttributes wattr;
-		XGetWindowAttributes(dpy,children[a],&wattr);
-
-	//	printf("Start 0x%lx\n", children[a]);
-		char* name = getWmName(dpy,children[a]);
-		char* className = getClassName(dpy, children[a]);
-		int nitems = 0;
-		long state = getWmState(dpy,children[a],&nitems);
-		int desktop = getWmDesktop(dpy,children[a]);
-		if (state != 0 && desktop != -1) {
-	//		printf("%d %d %d %d %d %s %s 0x%lx\n",desktop, 
-	//			wattr.x, wattr.y, wattr.width, wattr.height, 
-	//			className, name, children[a]);
-			MiniWindow* mw = makeMiniWindow(desktop,
-				wattr.x, wattr.y, wattr.width, wattr.height, 
-				className, name, children[a], sizing, monitors);
-			llist_addBack(miniWindows,mw);
-		}
+	darray* miniWindows = fetchMiniWindows(dpy, atoms, snapshot, children, nchildren, sizing, monitors);
+	if (children)
+		XFree(children);
+
+	return miniWindows;
+}
+
+// _NET_CLIENT_LIST_STACKING, bottom first.  Caller frees.
+Window* getClientList(Display* dpy, Atom* atoms, int* return_nitems) {
+	Atom actualType;
+	int format;
+	unsigned long nitems;
+	unsigned long bytesAfter;
+	unsigned char* value;
+	*return_nitems = 0;
+	XGetWindowProperty(dpy, DefaultRootWindow(dpy), atoms[ATOM_NET_CLIENT_LIST_STACKING],
+			0,4096,False,XA_WINDOW,
+			&actualType,&format,&nitems,&bytesAfter, &value);
+	if (value) {
+		Window* result = malloc((nitems + 1) * sizeof(Window));
+		if (result == NULL)
+			puts("Uh oh getClientList");
+		memcpy(result, value, nitems * sizeof(Window));
+		*return_nitems = nitems;
+		XFree(value);
+		return result;
 	}
+	return NULL;
+}
 
+// Only the managed clients, in the order the window manager claims they're stacked
+darray* testClientList(Display* dpy, Atom* atoms, arena* snapshot, Sizing* sizing, darray* monitors) {
+	int nclients;
+	Window* clients = getClientList(dpy, atoms, &nclients);
+	darray* miniWindows = fetchMiniWindows(dpy, atoms, snapshot, clients, nclients, sizing, monitors);
+	if (clients)
+		free(clients);
 	return miniWindows;
 }
 
-char** getWorkspaceNames(Display* dpy, int screen, int nWorkspaces) {
-	Atom prop = XInternAtom(dpy,"_NET_DESKTOP_NAMES",False);
-	Atom utf8String = XInternAtom(dpy,"UTF8_STRING",False);
+// Decide whether _NET_CLIENT_LIST_STACKING can stand in for walking the tree.
+// It can if every client is a direct child of the root (otherwise the
+// geometry and WM_STATE we read would belong to frames) and the clients
+// appear in the same relative order as the root's children.
+char probeClientList(Display* dpy, Atom* atoms) {
+	Window root;
+	Window parent;
+	Window *children;
+	unsigned int nchildren;
+	int nclients;
+	Window* clients = getClientList(dpy, atoms, &nclients);
+	if (clients == NULL)
+		return 0;
+	XQueryTree(dpy, DefaultRootWindow(dpy), &root, &parent, &children, &nchildren);
+
+	wtable* listed = wtable_create();
+	for (int i=0; i<nclients; i++)
+		wtable_put(listed, clients[i], &clients[i]);
+
+	// Walk the children in stacking order, they must hit the clients in list order
+	int next = 0;
+	for (int i=0; i<nchildren && next < nclients; i++) {
+		if (wtable_get(listed, children[i]) == NULL)
+			continue;
+		if (children[i] != clients[next])
+			break;
+		next++;
+	}
+	char trusted = next == nclients;
+	if (!trusted)
+		printf("_NET_CLIENT_LIST_STACKING disagrees with the window tree, walking the tree instead\n");
+
+	wtable_free(listed);
+	free(clients);
+	if (children)
+		XFree(children);
+	return trusted;
+}
+
+char** getWorkspaceNames(Display* dpy, Atom* atoms, int screen, int nWorkspaces) {
+	Atom prop = atoms[ATOM_NET_DESKTOP_NAMES];
+	Atom utf8String = atoms[ATOM_UTF8_STRING];
 	Atom actualType;
 	int format;
 	unsigned long nitems;
@@ -613,7 +1029,8 @@ char** getWorkspaceNames(Display* dpy, int screen, int nWorkspaces) {
 			&actualType,&format,&nitems,&bytesAfter, &value);
 //	printf("s = %d Value = %s bytesAfter = %ld actualType = %ld format = %d nitems = %d\n", s, value, bytesAfter, actualType, format, nitems);
 	
-	char** names = malloc(nWorkspaces*sizeof(char**));
+	// Not every desktop has to have a name
+	char** names = calloc(nWorkspaces, sizeof(char*));
 	if(names == NULL)
 		puts("Uh oh getWorkspaceNames");
 	int start = 0;
@@ -623,7 +1040,7 @@ char** getWorkspaceNames(Display* dpy, int screen, int nWorkspaces) {
 		if (value[i] == '\0') {
 			// hit the end of an array value
 			int size = i - start;
-			char* word = malloc(size * sizeof(char));
+			char* word = malloc((size + 1) * sizeof(char));
 			strcpy(word,(char*)(value+start));
 			names[total++] = word;
 			// UTF8 debugging (raw bytes)
@@ -641,50 +1058,40 @@ char** getWorkspaceNames(Display* dpy, int screen, int nWorkspaces) {
 	return names;
 }
 
-XftFont* initFont(Display* dpy, int screen, char* fontName, int pixelsize) {
-	// Load Font to use
-	char fontWithSize[100*sizeof(char)];
-	sprintf(fontWithSize, "%s:pixelsize=%d", fontName, pixelsize);
-	XftFont* font = XftFontOpenName(dpy, screen, fontWithSize);
-	if (!font) {
-		printf("failed to open font %s\n", fontName);
-		exit(1);
-	}
-	return font;
-}
-
-void reloadFontList(llist* fontList, char* rawFont, Display* dpy, int screen, int pixelsize) {
-	// cleanup
-	while (fontList->size > 0) {
-		XftFont* data = llist_remove(fontList, 0);
-		XftFontClose(dpy, data);
-	}
-
-	// Parse raw fonts (maybe cache the partial parse?)
-	char tmp[strlen(rawFont)];
-	strcpy(tmp, rawFont);
-	char* delimiter = ",";
-	char* ptr = strtok(tmp, delimiter);
-	while (ptr != NULL) {
-		XftFont* font = initFont(dpy, screen, ptr, pixelsize);
-		llist_addBack(fontList, font);
-		ptr = strtok(NULL,delimiter);
+// Reopen a fallback chain at pixelsize.  Fonts already open at that size
+// come from the cache instead of being matched again.
+void reloadFontList(fontlist* list, fontcache* cache, Display* dpy, int screen, int pixelsize) {
+	darray* fontList = list->fonts;
+	darray* old = darray_create(sizeof(XftFont*));
+	darray_reserve(old, fontList->size);
+	memcpy(old->data, fontList->data, fontList->size * sizeof(XftFont*));
+	old->size = fontList->size;
+
+	darray_clear(fontList);
+	fontlist_invalidate(list);
+	for (int i=0; i<list->specs->size; i++) {
+		XftFont* font = fontcache_open(cache, dpy, screen, DARRAY_AT(list->specs, char*, i), pixelsize);
+		darray_addBack(fontList, &font);
 	}
 
+	// Released after opening, so a font in both chains stays open
+	for (int i=0; i<old->size; i++)
+		fontcache_release(cache, dpy, DARRAY_AT(old, XftFont*, i));
+	darray_free(old);
 }
 
 void reloadFonts(Model* model, Display* dpy, int screen) {
 	GfxContext* ctx = model->gfx;
-	Sizing* s = model->sizing; // used for pixelsize scaling
-	int minDimension = s->previewHeight < s->previewWidth ? 
-		s->previewHeight : s->previewWidth;
-	int pixelsize = minDimension / 9;
+	int pixelsize = fontPixelsize(model->sizing);
+	model->pixelsize = pixelsize;
 
-	// Load Font(s) from a comma delimited string (not reentrant)
-	reloadFontList(ctx->fonts, model->rawFont, dpy, screen, pixelsize);
+	reloadFontList(ctx->fonts, ctx->fontCache, dpy, screen, pixelsize);
 	if (ctx->fonts != ctx->wFonts) {
-		reloadFontList(ctx->wFonts, model->rawWindowFont, dpy, screen, pixelsize);
+		reloadFontList(ctx->wFonts, ctx->fontCache, dpy, screen, pixelsize);
 	}
+	// Glyphs are cached per XftFont*, which a closed font's address may be reused for
+	if (model->soft)
+		soft_clearGlyphs(model->soft);
 }
 
 // Initializes everything we need for drawing to a Window/XftDraw
@@ -746,20 +1153,490 @@ GfxContext* initColors(Display* dpy, int screen, XDConfig* cfg) {
 	gcv_match.background = WhitePixel(dpy,screen); // ireelevant
 	gc_match = XCreateGC(dpy, RootWindow(dpy,screen), GCForeground | GCBackground, &gcv_match);
 	ctx->matched = gc_match;
+
+	ctx->batch = rectbatch_create();
+	ctx->batchText = darray_create(sizeof(int));
 	
 	return ctx;
 }
 
-void cleanupList(llist* list) {
-	while (list->size > 0) {
-		MiniWindow* mw = llist_remove(list, 0);
-		if (mw->className)
-			free(mw->className);
-		if (mw->name)
-			free(mw->name);
-		free(mw);
+void markWorkspace(Model* model, int workspace) {
+	if (workspace >= 0 && workspace < model->nWorkspaces)
+		model->dirty->workspaces[workspace / LONG_BITS] |= 1UL << (workspace % LONG_BITS);
+}
+
+void markAllWorkspaces(Model* model) {
+	for (int i=0; i<model->nWorkspaces; i++)
+		markWorkspace(model, i);
+}
+
+char anyWorkspaceDirty(Model* model) {
+	for (int i=0; i<model->nWorkspaces; i+=LONG_BITS)
+		if (model->dirty->workspaces[i / LONG_BITS])
+			return 1;
+	return 0;
+}
+
+// A tracked window moved, restacked or changed properties.  If it is (or
+// now is) previewed, the previews get refiltered once the batch is done.
+// Both the workspace it is drawn on and the one it is headed to get repainted.
+void markWindowChanged(Model* model, MiniWindow* mw) {
+	if (isPreviewable(mw) || mw->previewed) {
+		model->dirty->model = 1;
+		markWorkspace(model, mw->workspace);
+		if (mw->previewed)
+			markWorkspace(model, mw->previewedOn);
+	}
+}
+
+// The cell the search draws its string on, and the cells of every
+// highlighted match.  Nothing is highlighted while the buffer is empty.
+void markSearchResults(Model* model) {
+	darray* matched = model->search->matchedWindows;
+	markWorkspace(model, 0);
+	for (int i=0; model->search->size > 0 && i<matched->size; i++)
+		markWorkspace(model, DARRAY_AT(matched, MiniWindow*, i)->workspace);
+}
+
+// Untracked windows may still be referenced by the previews and the search
+// until the batch is flushed.  Their memory stays valid until the snapshot
+// arena is compacted, which only happens after that.
+void discardWindow(Model* model, MiniWindow* mw) {
+	markWindowChanged(model, mw);
+	if (model->stills)
+		thumbcache_remove(model->stills, mw->windowId);
+	model->garbage += sizeof(MiniWindow);
+	retireString(model, mw->className);
+	retireString(model, mw->name);
+}
+
+PreviewSet* previewSet_create(int nWorkspaces) {
+	PreviewSet* set = malloc(sizeof(PreviewSet));
+	set->size = 0;
+	set->capacity = 0;
+	set->nBuckets = nWorkspaces + 1;
+	set->bucketStart = calloc(set->nBuckets + 1, sizeof(int));
+	set->workspace = NULL;
+	set->rect = NULL;
+	set->classId = NULL;
+	set->window = NULL;
+	return set;
+}
+
+void previewSet_reserve(PreviewSet* set, int n) {
+	if (n <= set->capacity)
+		return;
+	int capacity = set->capacity ? set->capacity : 16;
+	while (capacity < n)
+		capacity *= 2;
+	set->workspace = realloc(set->workspace, capacity * sizeof(int));
+	set->rect = realloc(set->rect, capacity * sizeof(XRectangle));
+	set->classId = realloc(set->classId, capacity * sizeof(int));
+	set->window = realloc(set->window, capacity * sizeof(MiniWindow*));
+	if (!set->workspace || !set->rect || !set->classId || !set->window) {
+		puts("Uh oh previewSet_reserve");
+		exit(1);
+	}
+	set->capacity = capacity;
+}
+
+void previewSet_free(PreviewSet* set) {
+	free(set->bucketStart);
+	free(set->workspace);
+	free(set->rect);
+	free(set->classId);
+	free(set->window);
+	free(set);
+}
+
+// Bucket of the previews on workspace, anything out of range goes in the last one
+int previewBucket(PreviewSet* set, int workspace) {
+	if (workspace < 0 || workspace >= set->nBuckets - 1)
+		return set->nBuckets - 1;
+	return workspace;
+}
+
+// Index of className in the class table, adding it if it's new.
+// The table owns its strings so ids stay valid across snapshot swaps.
+int internClass(darray* classes, char* className) {
+	if (className == NULL)
+		return -1;
+	for (int i=0; i<classes->size; i++) {
+		if (strcmp(DARRAY_AT(classes, char*, i), className) == 0)
+			return i;
+	}
+	char* copy = strdup(className);
+	darray_addBack(classes, &copy);
+	return classes->size - 1;
+}
+
+// Refilter the previews from the stack.  This never talks to the server.
+// The stack is walked twice, once to size the buckets and once to fill them,
+// which keeps each bucket in stacking order.
+void rebuildPreviews(Model* model) {
+	PreviewSet* previews = model->previews;
+	darray* stack = model->stack;
+	int* start = previews->bucketStart;
+	memset(start, 0, (previews->nBuckets + 1) * sizeof(int));
+
+	int n = 0;
+	for (int i=0; i<stack->size; i++) {
+		MiniWindow* mw = DARRAY_AT(stack, MiniWindow*, i);
+		mw->previewed = isPreviewable(mw);
+		if (!mw->previewed)
+			continue;
+		mw->previewedOn = mw->workspace;
+		if (mw->classId == -2)
+			mw->classId = internClass(model->classes, mw->className);
+		start[previewBucket(previews, mw->workspace) + 1]++;
+		n++;
+	}
+	for (int b=0; b<previews->nBuckets; b++)
+		start[b+1] += start[b];
+	previewSet_reserve(previews, n);
+	previews->size = n;
+
+	// start[b] is used as the fill position of bucket b and ends up at the
+	// start of b+1, shift it back afterwards
+	for (int i=0; i<stack->size; i++) {
+		MiniWindow* mw = DARRAY_AT(stack, MiniWindow*, i);
+		if (!mw->previewed)
+			continue;
+		int p = start[previewBucket(previews, mw->workspace)]++;
+		previews->workspace[p] = mw->workspace;
+		previews->rect[p] = (XRectangle){mw->x, mw->y, mw->w, mw->h};
+		previews->classId[p] = mw->classId;
+		previews->window[p] = mw;
+	}
+	memmove(start + 1, start, previews->nBuckets * sizeof(int));
+	start[0] = 0;
+
+	// The selection may have moved off a window that went away
+	MiniWindow* oldSelection = model->search->selectedWindow;
+	updateSearchContext(model->search, previews, model->classes);
+	if (model->mode == 1 && model->search->selectedWindow != oldSelection) {
+		if (oldSelection)
+			markWorkspace(model, oldSelection->previewedOn);
+		if (model->search->selectedWindow)
+			markWorkspace(model, model->search->selectedWindow->workspace);
+	}
+}
+
+// Ask for PropertyNotify on a client so desktop/title/state changes come to us
+// instead of us polling for them.  Our own window already has an event mask
+// that this would replace.
+void watchWindow(Display* dpy, Model* model, MiniWindow* mw) {
+	if (!mw->override && mw->windowId != model->pagerWindow)
+		XSelectInput(dpy, mw->windowId, PropertyChangeMask);
+}
+
+void swapSnapshots(Model* model) {
+	arena* old = model->snapshot;
+	model->snapshot = model->spare;
+	model->spare = old;
+	model->garbage = 0;
+}
+
+// Previews are rebuilt against new MiniWindows, carry the search selection over
+void rebuildPreviewsAfterSwap(Model* model, Window selected) {
+	model->search->selectedWindow = selected ? wtable_get(model->windows, selected) : NULL;
+	rebuildPreviews(model);
+}
+
+// Throw away everything we know and ask the server for the whole tree again.
+// Only needed at startup or when the table is suspected to be stale.
+// The new snapshot is built in the spare arena, so the old one stays valid
+// until everything has been pointed at the new one.
+void resyncWindows(Display* dpy, Model* model) {
+	arena_reset(model->spare);
+	MiniWindow* sel = model->search->selectedWindow;
+	Window selected = sel ? sel->windowId : None;
+
+	darray* stack;
+	if (model->clientListMode)
+		model->useClientList = probeClientList(dpy, model->atoms);
+	if (model->useClientList)
+		stack = testClientList(dpy, model->atoms, model->spare, model->sizing, model->monitors);
+	else
+		stack = testX(dpy, model->atoms, model->spare, model->sizing, model->monitors);
+
+	wtable_clear(model->windows);
+	darray_free(model->stack);
+	model->stack = stack;
+
+	for (int i=0; i<stack->size; i++) {
+		MiniWindow* mw = DARRAY_AT(stack, MiniWindow*, i);
+		wtable_put(model->windows, mw->windowId, mw);
+		watchWindow(dpy, model, mw);
+	}
+	swapSnapshots(model);
+	rebuildPreviewsAfterSwap(model, selected);
+}
+
+// Copy every tracked window into the spare arena and swap, dropping the
+// records and strings of windows and titles that have gone away since.
+// Like a resync but without asking the server anything.
+void compactWindows(Model* model) {
+	arena* fresh = model->spare;
+	arena_reset(fresh);
+	MiniWindow* sel = model->search->selectedWindow;
+	Window selected = sel ? sel->windowId : None;
+
+	for (int i=0; i<model->stack->size; i++) {
+		MiniWindow* old = DARRAY_AT(model->stack, MiniWindow*, i);
+		MiniWindow* mw = arena_alloc(fresh, sizeof(MiniWindow));
+		*mw = *old;
+		if (old->className)
+			mw->className = arena_strndup(fresh, old->className, strlen(old->className));
+		if (old->name)
+			mw->name = arena_strndup(fresh, old->name, strlen(old->name));
+		DARRAY_AT(model->stack, MiniWindow*, i) = mw;
+		wtable_put(model->windows, mw->windowId, mw);
+	}
+	swapSnapshots(model);
+	rebuildPreviewsAfterSwap(model, selected);
+}
+
+// Moves mw directly above sibling in the stacking order, or to the bottom if sibling is None
+void restackWindow(Model* model, MiniWindow* mw, Window sibling) {
+	int pos = darray_indexOf(model->stack, mw);
+	if (pos >= 0)
+		darray_remove(model->stack, pos);
+
+	int target = 0;
+	if (sibling != None) {
+		MiniWindow* below = wtable_get(model->windows, sibling);
+		target = below ? darray_indexOf(model->stack, below) + 1 : model->stack->size;
+	}
+	darray_insert(model->stack, target, &mw);
+}
+
+void trackWindow(Model* model, MiniWindow* mw) {
+	MiniWindow* old = wtable_remove(model->windows, mw->windowId);
+	if (old != NULL) {
+		darray_remove(model->stack, darray_indexOf(model->stack, old));
+		discardWindow(model, old);
+	}
+	wtable_put(model->windows, mw->windowId, mw);
+	darray_addBack(model->stack, &mw); // new root children start on top
+}
+
+void untrackWindow(Model* model, Window w) {
+	MiniWindow* mw = wtable_remove(model->windows, w);
+	if (mw == NULL)
+		return;
+	darray_remove(model->stack, darray_indexOf(model->stack, mw));
+	discardWindow(model, mw);
+}
+
+// Bring the table in line with _NET_CLIENT_LIST_STACKING: fetch the clients
+// that are new to it in one batch, drop the ones that left it and take its
+// order as the stacking order
+void syncClientList(Display* dpy, Model* model) {
+	int nclients;
+	Window* clients = getClientList(dpy, model->atoms, &nclients);
+
+	Window* fresh = malloc((nclients + 1) * sizeof(Window));
+	int nfresh = 0;
+	for (int i=0; i<nclients; i++) {
+		if (wtable_get(model->windows, clients[i]) == NULL)
+			fresh[nfresh++] = clients[i];
+	}
+	darray* fetched = fetchMiniWindows(dpy, model->atoms, model->snapshot, fresh, nfresh, model->sizing, model->monitors);
+	for (int i=0; i<fetched->size; i++) {
+		MiniWindow* mw = DARRAY_AT(fetched, MiniWindow*, i);
+		wtable_put(model->windows, mw->windowId, mw);
+		watchWindow(dpy, model, mw);
+		markWindowChanged(model, mw);
+	}
+	darray_free(fetched);
+	free(fresh);
+
+	// Anything left in the table that isn't listed anymore is gone
+	wtable* listed = wtable_create();
+	darray* stack = darray_create(sizeof(MiniWindow*));
+	darray_reserve(stack, nclients);
+	for (int i=0; i<nclients; i++) {
+		MiniWindow* mw = wtable_get(model->windows, clients[i]);
+		if (mw != NULL) {
+			darray_addBack(stack, &mw);
+			wtable_put(listed, clients[i], mw);
+		}
+	}
+	for (int i=0; i<model->stack->size; i++) {
+		MiniWindow* mw = DARRAY_AT(model->stack, MiniWindow*, i);
+		if (wtable_get(listed, mw->windowId) == NULL) {
+			wtable_remove(model->windows, mw->windowId);
+			discardWindow(model, mw);
+		} else if (i >= stack->size || DARRAY_AT(stack, MiniWindow*, i) != mw) {
+			// Restacked (or shifted by a removal below it)
+			markWindowChanged(model, mw);
+		}
+	}
+
+	darray_free(model->stack);
+	model->stack = stack;
+	wtable_free(listed);
+	if (clients)
+		free(clients);
+}
+
+// Apply a SubstructureNotify event on the root to the window table,
+// marking whatever needs rebuilding or repainting
+void applyWindowEvent(Display* dpy, Model* model, XEvent* event) {
+	MiniWindow* mw;
+
+	switch (event->type) {
+		case CreateNotify: {
+			XCreateWindowEvent* e = &event->xcreatewindow;
+			// Clients only matter once they show up in the client list
+			if (e->parent != DefaultRootWindow(dpy) || model->useClientList)
+				return;
+			// Nothing worth reading has been set on a window this young,
+			// properties are fetched when it gets mapped
+			mw = makeMiniWindow(model->snapshot, e->x, e->y, e->width, e->height, e->override_redirect,
+					e->window, model->sizing, model->monitors);
+			trackWindow(model, mw);
+			watchWindow(dpy, model, mw);
+			return;
+		}
+		case DestroyNotify:
+			untrackWindow(model, event->xdestroywindow.window);
+			return;
+		case ReparentNotify: {
+			XReparentEvent* e = &event->xreparent;
+			if (e->parent != DefaultRootWindow(dpy)) {
+				untrackWindow(model, e->window);
+				return;
+			}
+			if (model->useClientList)
+				return;
+			mw = fetchMiniWindow(dpy, model, e->window);
+			if (mw == NULL)
+				return;
+			trackWindow(model, mw);
+			watchWindow(dpy, model, mw);
+			markWindowChanged(model, mw);
+			return;
+		}
+		case MapNotify:
+		case UnmapNotify:
+			// XMapEvent and XUnmapEvent share their layout up to window
+			mw = wtable_get(model->windows, event->xmap.window);
+			if (mw == NULL || event->xmap.event != DefaultRootWindow(dpy))
+				return;
+			mw->mapped = event->type == MapNotify;
+			// Thumbnails follow the mapped previews
+			if (model->thumbs && mw->previewed) {
+				model->dirty->model = 1;
+				markWorkspace(model, mw->previewedOn);
+			}
+			if (mw->override || mw->known)
+				return;
+			// Properties set between the window's creation and our
+			// XSelectInput on it never made it to us as PropertyNotify.
+			// Later changes will, so this only happens once per window.
+			fetchWindowProps(dpy, model, mw);
+			markWindowChanged(model, mw);
+			return;
+		case ConfigureNotify: {
+			XConfigureEvent* e = &event->xconfigure;
+			mw = wtable_get(model->windows, e->window);
+			if (mw == NULL || e->event != DefaultRootWindow(dpy))
+				return;
+			if (model->thumbs && (mw->rw != e->width || mw->rh != e->height))
+				thumbs_invalidate(model->thumbs, mw->windowId);
+			mw->rx = e->x;
+			mw->ry = e->y;
+			mw->rw = e->width;
+			mw->rh = e->height;
+			scaleMiniWindow(mw, model->sizing, model->monitors);
+			// With a trusted client list, the list is the stacking order
+			if (!model->useClientList)
+				restackWindow(model, mw, e->above);
+			markWindowChanged(model, mw);
+			return;
+		}
+		case GravityNotify:
+			mw = wtable_get(model->windows, event->xgravity.window);
+			if (mw == NULL || event->xgravity.event != DefaultRootWindow(dpy))
+				return;
+			mw->rx = event->xgravity.x;
+			mw->ry = event->xgravity.y;
+			scaleMiniWindow(mw, model->sizing, model->monitors);
+			markWindowChanged(model, mw);
+			return;
+		case CirculateNotify: {
+			XCirculateEvent* e = &event->xcirculate;
+			mw = wtable_get(model->windows, e->window);
+			if (mw == NULL || e->event != DefaultRootWindow(dpy) || model->useClientList)
+				return;
+			darray_remove(model->stack, darray_indexOf(model->stack, mw));
+			if (e->place == PlaceOnTop)
+				darray_addBack(model->stack, &mw);
+			else
+				darray_insert(model->stack, 0, &mw);
+			markWindowChanged(model, mw);
+			return;
+		}
 	}
-	free(list);
+}
+
+// Apply a PropertyNotify from the root or a tracked client by re-reading
+// only the property that changed
+void applyPropertyEvent(Display* dpy, Model* model, XPropertyEvent* e) {
+	Atom* atoms = model->atoms;
+	char deleted = e->state == PropertyDelete;
+
+	if (e->window == DefaultRootWindow(dpy)) {
+		if (e->atom == atoms[ATOM_NET_CURRENT_DESKTOP]) {
+			model->currentDesktop = deleted ? -1 : getCurrentDesktop(dpy, atoms);
+			// When the selection drives the desktop we'd only be fighting it.
+			// A hidden daemon follows it so the next show has nothing to redraw.
+			if ((navType == NAV_NORMAL_SELECTION || model->hidden) && model->mode == 0 &&
+					model->currentDesktop >= 0 && model->currentDesktop < model->nWorkspaces &&
+					model->currentDesktop != model->selected) {
+				markWorkspace(model, model->selected);
+				model->selected = model->currentDesktop;
+				markWorkspace(model, model->selected);
+			}
+		} else if (e->atom == atoms[ATOM_NET_DESKTOP_NAMES]) {
+			for (int i=0; i<model->nWorkspaces; i++) {
+				if (model->workspaceNames[i])
+					free(model->workspaceNames[i]);
+			}
+			free(model->workspaceNames);
+			model->workspaceNames = getWorkspaceNames(dpy, atoms, DefaultScreen(dpy), model->nWorkspaces);
+			markAllWorkspaces(model);
+		} else if (e->atom == atoms[ATOM_NET_CLIENT_LIST_STACKING] && model->useClientList) {
+			syncClientList(dpy, model);
+		}
+		return;
+	}
+
+	MiniWindow* mw = wtable_get(model->windows, e->window);
+	if (mw == NULL || mw->override)
+		return;
+	int nitems = 0;
+
+	if (e->atom == atoms[ATOM_NET_WM_DESKTOP]) {
+		mw->workspace = deleted ? -1 : getWmDesktop(dpy, atoms, mw->windowId);
+	} else if (e->atom == atoms[ATOM_WM_STATE]) {
+		mw->state = deleted ? 0 : getWmState(dpy, atoms, mw->windowId, &nitems);
+	} else if (e->atom == atoms[ATOM_NET_WM_NAME]) {
+		retireString(model, mw->name);
+		mw->name = deleted ? NULL : getWmName(dpy, atoms, model->snapshot, mw->windowId);
+	} else if (e->atom == XA_WM_CLASS) {
+		retireString(model, mw->className);
+		mw->className = deleted ? NULL : getClassName(dpy, model->snapshot, mw->windowId);
+		mw->classId = -2;
+		lowercase(mw->className);
+	} else {
+		return;
+	}
+
+	// Membership or search matches may have changed
+	markWindowChanged(model, mw);
 }
 
 
@@ -771,30 +1648,62 @@ void resizeWorkspaceWindows(Display* dpy, Model* m) {
 	Window* workspaces = m->workspaces;
 	int nWorkspaces = m->nWorkspaces;
 	int workspacesPerRow = m->workspacesPerRow;
+	int screen = DefaultScreen(dpy);
 	
 	int nRows = nWorkspaces/workspacesPerRow;
 	if (nWorkspaces % workspacesPerRow != 0)
 		nRows += 1;
 	int windowWidth = ((s->width - MARGIN) / workspacesPerRow ) - MARGIN;
 	int windowHeight = ((s->height - MARGIN) / nRows) - MARGIN;
+	char resized = windowWidth != s->previewWidth || windowHeight != s->previewHeight;
+	s->previewWidth = windowWidth;
+	s->previewHeight = windowHeight;
+
+	if (m->renderer == RENDER_SINGLE) {
+		// One buffer the size of the pager.  The margins between cells are
+		// never drawn again, fill them with the main window's background.
+		XFreePixmap(dpy, m->buffers[0]);
+		m->buffers[0] = XCreatePixmap(dpy, m->pagerWindow, s->width, s->height, DefaultDepth(dpy, screen));
+		XftDrawChange(m->draws[0], m->buffers[0]);
+		XGCValues gcv;
+		gcv.foreground = BlackPixel(dpy, screen);
+		GC gc = XCreateGC(dpy, m->buffers[0], GCForeground, &gcv);
+		XFillRectangle(dpy, m->buffers[0], gc, 0, 0, s->width, s->height);
+		XFreeGC(dpy, gc);
+		return;
+	}
+	if (m->renderer == RENDER_SOFTWARE) {
+		soft_resize(m->soft, s->width, s->height);
+		soft_setClip(m->soft, (XRectangle){0, 0, s->width, s->height});
+		soft_fill(m->soft, 0, 0, s->width, s->height, BlackPixel(dpy, screen));
+		return;
+	}
+
 	for (int i=0; i<nWorkspaces; i++) {
-		int xoff = i%workspacesPerRow;
-		int yoff = i/workspacesPerRow;
-		int x = (xoff * windowWidth) + ( (xoff+ 1) * MARGIN );
-		int y = (yoff * windowHeight) + ( (yoff+1) * MARGIN);
+		int x, y;
+		cellOrigin(m, i, &x, &y);
 		// printf("resize %d %d %d %d %d %d\n", x, y, windowWidth, windowHeight, s->width, s->height);
 		XMoveResizeWindow(dpy, workspaces[i], x, y, windowWidth, windowHeight);
-	}
 
-	s->previewWidth = windowWidth;
-	s->previewHeight = windowHeight;
+		// Back buffers are as big as their window, the contents get redrawn anyway
+		if (resized) {
+			XFreePixmap(dpy, m->buffers[i]);
+			m->buffers[i] = XCreatePixmap(dpy, workspaces[i], windowWidth, windowHeight,
+					DefaultDepth(dpy, screen));
+			XftDrawChange(m->draws[i], m->buffers[i]);
+		}
+	}
 }
 
 void handleResize(Display* dpy, int screen, Model* model) {
 	resizeWorkspaceWindows(dpy, model);
-	cleanupList(model->previews);
-	model->previews = testX(dpy, model->sizing, model->monitors);
-	reloadFonts(model, dpy, screen);
+	for (int i=0; i<model->stack->size; i++)
+		scaleMiniWindow(DARRAY_AT(model->stack, MiniWindow*, i), model->sizing, model->monitors);
+	model->dirty->model = 1; // previews hold a copy of the scaled geometry
+	// Only reopen fonts if the new cell size actually changes their size
+	if (model->dirty->fonts || fontPixelsize(model->sizing) != model->pixelsize)
+		reloadFonts(model, dpy, screen);
+	markAllWorkspaces(model);
 //	printf("w,h %d,%d\n", model->sizing->width, model->sizing->height);
 }
 
@@ -816,34 +1725,42 @@ int workspaceKey(KeySym sym, Model* model, Display* dpy, int screen, Window wMai
 		int tmp_s = model->selected - model->workspacesPerRow;
 		model->selected = tmp_s < 0 ? model->nWorkspaces + tmp_s : tmp_s;	
 	} else if (sym == XK_Return) {
-		char command[23*sizeof(char)];
-		sprintf(command, "xdotool set_desktop %d", model->selected);
-		system(command);
+		switchDesktop(dpy, model->atoms, model->selected);
 		return 1;
 	} else if (sym == XK_slash) {
 		model->mode = 1; // switch to search mode
+		// The selected cell loses its highlight and the search string appears
+		markWorkspace(model, model->selected);
+		markWorkspace(model, 0);
 	} else if (sym == XK_F2) {
 		model->windowTextMode = (model->windowTextMode + 1) % 3;
+		markAllWorkspaces(model);
 	} else if (sym == XK_F3) {
 		if (model->workspacesPerRow < model->nWorkspaces) {
 			model->workspacesPerRow++;
-			handleResize(dpy, screen, model);
+			model->dirty->layout = 1;
 		}
 	} else if (sym == XK_F4) {
 		if (model->workspacesPerRow > 1) {
 			model->workspacesPerRow--;
-			handleResize(dpy, screen, model);
+			model->dirty->layout = 1;
 		}
+	} else if (sym == XK_F5) {
+		// Consistency check in case we missed an event somewhere
+		resyncWindows(dpy, model);
+		markAllWorkspaces(model);
 	}
 
 	// If using interactive selection navigation
 	if (oldSelected != model->selected) {
+		markWorkspace(model, oldSelected);
+		markWorkspace(model, model->selected);
 		if (navType == NAV_MOVE_WITH_SELECTION) {
-			switchDesktop(model->selected);
-			grabFocus(wMain);
+			switchDesktop(dpy, model->atoms, model->selected);
+			grabFocus(dpy, wMain);
 		} else if (navType == NAV_MOVE_WITH_SELECTION_EXPERIMENTAL) {
-			setDesktopForWindow(wMain, model->selected);
-			activateWindow(wMain);
+			setDesktopForWindow(dpy, model->atoms, wMain, model->selected);
+			activateWindow(dpy, model->atoms, wMain);
 		}
 	}
 
@@ -852,61 +1769,101 @@ int workspaceKey(KeySym sym, Model* model, Display* dpy, int screen, Window wMai
 
 // Handle a keypress in the search  mode
 // returns whether or not we should exit afterwards
-int searchKey(KeySym sym, Model* model, GfxContext* colorsCtx) {
+int searchKey(KeySym sym, Model* model, Display* dpy, GfxContext* colorsCtx) {
 	
 	SearchContext* search = model->search;
+	MiniWindow* oldSelection = search->selectedWindow;
+	// Whatever was highlighted before the key may not be afterwards
+	char rematch = sym != XK_Left && sym != XK_Right;
+	if (rematch)
+		markSearchResults(model);
+
 	if (sym == XK_Escape) {
 		if (search->size > 0) {
 			// If we have a search string, clear it instead of exiting
 			search->buffer[0] = '\0';
 			search->size = 0;
-			updateSearchContext(search, model->previews);
+			updateSearchContext(search, model->previews, model->classes);
 		}
 		model->mode = 0; // switch back to workspace mode
+		markWorkspace(model, model->selected);
 	} else if (sym == XK_Right) {
 		if (search->selectedWindow && search->size > 0) {
-			for(int k=0; k<search->nMatched; ++k) {
-				if (search->matchedWindows[k] == search->selectedWindow) {
-					search->selectedWindow = search->matchedWindows[(k+1)%search->nMatched];
-					break;
-				}
-			}
+			darray* matched = search->matchedWindows;
+			int k = darray_indexOf(matched, search->selectedWindow);
+			if (k >= 0)
+				search->selectedWindow = DARRAY_AT(matched, MiniWindow*, (k+1)%matched->size);
 		}
 	} else if (sym == XK_Left) {
 		if (search->selectedWindow && search->size > 0) {
-			for(int k=0; k<search->nMatched; ++k) {
-				if (search->matchedWindows[k] == search->selectedWindow) {
-					int idx = k == 0 ? search->nMatched - 1 : k -1;
-					search->selectedWindow = search->matchedWindows[idx];
-					break;
-				}
+			darray* matched = search->matchedWindows;
+			int k = darray_indexOf(matched, search->selectedWindow);
+			if (k >= 0) {
+				int idx = k == 0 ? matched->size - 1 : k -1;
+				search->selectedWindow = DARRAY_AT(matched, MiniWindow*, idx);
 			}
 		}
 	} else if (sym == XK_Return) {
 		if (search->selectedWindow && search->size > 0) {
-			char command[35*sizeof(char)];
-			sprintf(command, "xdotool windowactivate %ld", search->selectedWindow->windowId);
-			system(command);
+			// Like xdotool windowactivate, go to its desktop first
+			switchDesktop(dpy, model->atoms, search->selectedWindow->workspace);
+			activateWindow(dpy, model->atoms, search->selectedWindow->windowId);
 			return 1;
 		}
 	} else if ((sym >= XK_a && sym <= XK_z) || (sym >= XK_A && sym <= XK_Z)) {
-		if (search->size < 20) {
-			strncat(search->buffer, XKeysymToString(sym), 1);
-			search->size++;
-			updateSearchContext(search, model->previews);
+		if (search->size + 1 >= search->capacity) {
+			char* buffer = realloc(search->buffer, search->capacity * 2);
+			if (buffer == NULL) {
+				puts("Uh oh search buffer");
+				return 0;
+			}
+			search->buffer = buffer;
+			search->capacity *= 2;
 		}
+		search->buffer[search->size++] = XKeysymToString(sym)[0];
+		search->buffer[search->size] = '\0';
+		narrowSearchContext(search, model->classes);
 	} else if(sym == XK_BackSpace) {
 		if (search->size > 0) {
 			search->buffer[search->size-1] = '\0';
 			search->size--;
-			updateSearchContext(search, model->previews);
+			updateSearchContext(search, model->previews, model->classes);
 		}
 	}
 
+	if (search->selectedWindow != oldSelection) {
+		if (oldSelection)
+			markWorkspace(model, oldSelection->workspace);
+		if (search->selectedWindow)
+			markWorkspace(model, search->selectedWindow->workspace);
+	}
+	if (rematch)
+		markSearchResults(model);
+
 	return 0;
 }
 
 
+// The workspace under x, y of an event on window w, or -1.  With a single
+// surface the cell has to be worked out from the position.
+int workspaceAt(Model* m, Window w, int x, int y) {
+	if (m->renderer == RENDER_WINDOWS)
+		return findPointerWorkspace(w, m->workspaces, m->nWorkspaces);
+	if (w != m->pagerWindow || x < MARGIN || y < MARGIN)
+		return -1;
+	int pw = m->sizing->previewWidth;
+	int ph = m->sizing->previewHeight;
+	int col = (x - MARGIN) / (pw + MARGIN);
+	int row = (y - MARGIN) / (ph + MARGIN);
+	// In the margin after a cell
+	if ((x - MARGIN) % (pw + MARGIN) >= pw || (y - MARGIN) % (ph + MARGIN) >= ph)
+		return -1;
+	if (col >= m->workspacesPerRow)
+		return -1;
+	int i = row * m->workspacesPerRow + col;
+	return i < m->nWorkspaces ? i : -1;
+}
+
 char isWorkspaceWindow(Window* workspaces, int nWorkspaces, Window w) {
 	for (int i=0; i<nWorkspaces; i++) {
 		if (workspaces[i] == w)
@@ -916,15 +1873,478 @@ char isWorkspaceWindow(Window* workspaces, int nWorkspaces, Window w) {
 }
 
 
+// Handle a single event, deferring rebuilds and redraws to flushDirty()
+// returns whether or not we should exit afterwards
+int handleEvent(Display* dpy, int screen, Model* model, XEvent* event) {
+	Window win = model->pagerWindow;
+	Window* workspaces = model->workspaces;
+	unsigned short nWorkspaces = model->nWorkspaces;
+	int i;
+
+	// Something drew into a window we show the contents of
+	if (model->thumbs && thumbs_handleEvent(model->thumbs, event))
+		return 0;
+
+	// Window resize events
+	if (event->type == ConfigureNotify) {
+//		printf("ConfigureNotify %lx %lx (%d,%d,%d,%d) %lx\n", 
+//				event->xconfigure.window, event->xconfigure.event,
+//				event->xconfigure.x, event->xconfigure.y, 
+//				event->xconfigure.width, event->xconfigure.height,
+//				event->xconfigure.above);
+//		TODO: Ignore events from our child windows as they don't require redraws
+		if (event->xconfigure.window == win) {
+			// If our window has been resized, update the scale factors
+			int w = event->xconfigure.width;
+			int h = event->xconfigure.height; 
+			if (model->sizing->width != w || model->sizing->height != h) {
+				model->sizing->width = w;
+				model->sizing->height = h;
+				model->dirty->layout = 1;
+			}
+			applyWindowEvent(dpy, model, event);
+		} else if (model->renderer == RENDER_WINDOWS &&
+				isWorkspaceWindow(workspaces, nWorkspaces, event->xconfigure.window)) {
+			printf("notify on child window 0x%lx\n", event->xconfigure.window);
+		} else {
+			// Some other window has changed size
+			// Don't need to update our layout or scaling, just the previews
+			applyWindowEvent(dpy, model, event);
+		}
+	}
+
+	// Other structure changes of the root's children
+	// Only touched windows we preview are marked.  Reason for filtering is 
+	// we get events for non-relevant sub-windows that cause useless redraws.
+	if (event->type == CreateNotify || event->type == DestroyNotify || 
+			event->type == ReparentNotify || event->type == MapNotify || 
+			event->type == UnmapNotify || event->type == GravityNotify ||
+			event->type == CirculateNotify) {
+		applyWindowEvent(dpy, model, event);
+	}
+
+	// Expose events
+	// The back buffers still hold the last frame, so damage is repaired by
+	// copying just the exposed rectangle.  Dirty workspaces get presented
+	// in full when the batch is flushed anyway.
+	if (event->type == Expose) {
+		//printf("Expose event for %lx\n", event->xexpose.window);
+		XExposeEvent* e = &event->xexpose;
+		if (model->renderer == RENDER_SINGLE) {
+			// Margins included, everything on the main window is in the buffer
+			if (e->window == win)
+				XCopyArea(dpy, model->buffers[0], win, model->gfx->workspace,
+						e->x, e->y, e->width, e->height, e->x, e->y);
+		} else if (model->renderer == RENDER_SOFTWARE) {
+			if (e->window == win)
+				soft_present(model->soft, win, model->gfx->workspace, e->x, e->y, e->width, e->height);
+		} else {
+			i = findPointerWorkspace(e->window, workspaces, nWorkspaces);
+			if (i >= 0 && !isWorkspaceDirty(model, i))
+				presentWorkspace(dpy, model, i, e->x, e->y, e->width, e->height);
+		}
+		if (e->count == 0 && e->window == win && navType == NAV_MOVE_WITH_SELECTION) {
+			grabFocus(dpy, win);
+		}
+	}
+
+	// Property changes on the root or a tracked client
+	if (event->type == PropertyNotify) {
+		applyPropertyEvent(dpy, model, &event->xproperty);
+	}
+
+	// Key events
+	if (event->type == KeyPress) {
+		KeySym sym = XLookupKeysym(&event->xkey, 0);
+		//printf("keycode %d %s\n", event->xkey.keycode, XKeysymToString(sym));
+		int shouldExit = 0;
+		switch(model->mode) {
+			case 0:
+				shouldExit = workspaceKey(sym, model, dpy, screen, win);
+				break;
+			case 1:
+				shouldExit = searchKey(sym, model, dpy, model->gfx);
+				break;
+			default: 
+				printf("Unknown mode %d\n",model->mode);
+				shouldExit = 1;
+				break;
+		}
+		if (shouldExit == 1)
+			return 1; // goto cleanup
+		// The key handlers marked whatever they changed
+		if (navType == NAV_MOVE_WITH_SELECTION) {
+			grabFocus(dpy, win);
+		}
+	}
+	
+	// Mouse movement
+	// Mouse selection of filtered windows not implemented. Would need to do geometry range checking
+	if (event->type == MotionNotify && model->mode == 0) {
+		int pWorkspace = workspaceAt(model, event->xmotion.window, event->xmotion.x, event->xmotion.y);
+		// Between cells of the single surface, keep what was selected
+		if (pWorkspace >= 0 && pWorkspace != model->selected){
+			markWorkspace(model, model->selected);
+			model->selected = pWorkspace;
+			markWorkspace(model, model->selected);
+			if (navType == NAV_MOVE_WITH_SELECTION) {
+				switchDesktop(dpy, model->atoms, model->selected);
+				grabFocus(dpy, win);
+			} else if (navType == NAV_MOVE_WITH_SELECTION_EXPERIMENTAL) {
+				setDesktopForWindow(dpy, model->atoms, win, model->selected);
+				activateWindow(dpy, model->atoms, win);
+			}
+		}
+	}
+
+	// If a childwindow is clicked, move to the workspace
+	if (event->type == ButtonRelease && model->mode == 0) {
+		i = workspaceAt(model, event->xbutton.window, event->xbutton.x, event->xbutton.y);
+		if (i >= 0)
+			switchDesktop(dpy, model->atoms, i);
+		// Always termiante even if we don't move
+		return 1;
+	}
+
+	return 0;
+}
+
+// Everything the first frame of the next launch needs: the previews and
+// desktop names.  The fonts they're drawn with are saved by the font cache.
+void saveSnapshot(Model* model) {
+	char* path = snapfile_path();
+	if (path == NULL)
+		return;
+	snapwriter* w = snapwriter_create();
+	PreviewSet* previews = model->previews;
+	for (int i=0; i<previews->bucketStart[model->nWorkspaces]; i++) {
+		MiniWindow* mw = previews->window[i];
+		snapWindow sw;
+		sw.windowId = mw->windowId;
+		sw.workspace = mw->workspace;
+		sw.rx = mw->rx;
+		sw.ry = mw->ry;
+		sw.rw = mw->rw;
+		sw.rh = mw->rh;
+		sw.state = mw->state;
+		sw.mapped = mw->mapped;
+		sw.className = snapwriter_string(w, mw->className);
+		sw.name = snapwriter_string(w, mw->name);
+		snapwriter_addWindow(w, &sw);
+	}
+	for (int i=0; i<model->nWorkspaces; i++)
+		snapwriter_addName(w, model->workspaceNames[i]);
+	fontdisk_save(model->gfx->fontCache->disk);
+	if (!snapwriter_save(w, path))
+		printf("Couldn't save snapshot to %s\n", path);
+	snapwriter_free(w);
+	free(path);
+}
+
+char** restoreWorkspaceNames(snapfile* f, int nWorkspaces) {
+	char** names = calloc(nWorkspaces, sizeof(char*));
+	for (int i=0; i<nWorkspaces && i<f->header->nWorkspaces; i++) {
+		char* name = snapfile_string(f, f->names[i]);
+		if (name != NULL)
+			names[i] = strdup(name);
+	}
+	return names;
+}
+
+// Whether every font of ctx was resolved at pixelsize by an earlier launch,
+// which is what drawing a frame before asking the server needs
+char fontsOnDisk(GfxContext* ctx, int pixelsize) {
+	fontlist* lists[2] = {ctx->fonts, ctx->wFonts};
+	for (int l=0; l<2; l++) {
+		for (int i=0; i<lists[l]->specs->size; i++) {
+			if (!fontdisk_has(ctx->fontCache->disk, DARRAY_AT(lists[l]->specs, char*, i), pixelsize))
+				return 0;
+		}
+	}
+	return 1;
+}
+
+// The previews as they were saved, until the server has been asked
+void restoreSnapshotWindows(Model* model, snapfile* f) {
+	for (int i=0; i<f->header->nWindows; i++) {
+		snapWindow* sw = &f->windows[i];
+		MiniWindow* mw = makeMiniWindow(model->snapshot, sw->rx, sw->ry, sw->rw, sw->rh, False,
+				sw->windowId, model->sizing, model->monitors);
+		mw->state = sw->state;
+		mw->workspace = sw->workspace;
+		mw->mapped = sw->mapped;
+		mw->known = 1;
+		char* className = snapfile_string(f, sw->className);
+		char* name = snapfile_string(f, sw->name);
+		if (className)
+			mw->className = arena_strndup(model->snapshot, className, strlen(className));
+		if (name)
+			mw->name = arena_strndup(model->snapshot, name, strlen(name));
+		trackWindow(model, mw);
+	}
+	rebuildPreviews(model);
+}
+
+static unsigned int hashBytes(unsigned int hash, void* bytes, int len) {
+	for (int i=0; i<len; i++)
+		hash = (hash ^ ((unsigned char*)bytes)[i]) * 16777619u;
+	return hash;
+}
+
+// FNV-1a of everything drawn for the previews of a workspace
+unsigned int workspaceHash(Model* model, int workspace) {
+	PreviewSet* previews = model->previews;
+	unsigned int hash = 2166136261u;
+	for (int i=previews->bucketStart[workspace]; i<previews->bucketStart[workspace+1]; i++) {
+		MiniWindow* mw = previews->window[i];
+		hash = hashBytes(hash, &mw->windowId, sizeof(mw->windowId));
+		hash = hashBytes(hash, &previews->rect[i], sizeof(XRectangle));
+		hash = hashBytes(hash, &mw->mapped, sizeof(mw->mapped));
+		if (mw->className)
+			hash = hashBytes(hash, mw->className, strlen(mw->className) + 1);
+		if (mw->name)
+			hash = hashBytes(hash, mw->name, strlen(mw->name) + 1);
+	}
+	return hash;
+}
+
+// Swaps in the window manager's desktop names, repainting the ones that changed
+void reconcileWorkspaceNames(Display* dpy, Model* model) {
+	char** names = getWorkspaceNames(dpy, model->atoms, DefaultScreen(dpy), model->nWorkspaces);
+	for (int i=0; i<model->nWorkspaces; i++) {
+		char* old = model->workspaceNames[i];
+		if ((old == NULL) != (names[i] == NULL) || (old && strcmp(old, names[i]) != 0))
+			markWorkspace(model, i);
+		free(old);
+	}
+	free(model->workspaceNames);
+	model->workspaceNames = names;
+}
+
+// Replaces what was restored from the snapshot with what's actually there,
+// repainting only the workspaces that look different
+void reconcileSnapshot(Display* dpy, Model* model) {
+	unsigned int before[model->nWorkspaces];
+	for (int i=0; i<model->nWorkspaces; i++)
+		before[i] = workspaceHash(model, i);
+	resyncWindows(dpy, model);
+	for (int i=0; i<model->nWorkspaces; i++) {
+		if (workspaceHash(model, i) != before[i])
+			markWorkspace(model, i);
+	}
+	reconcileWorkspaceNames(dpy, model);
+}
+
+// Where a launch would have exited, a daemon goes back to waiting.  The
+// next launch starts over from the current desktop in workspace mode.
+void hidePager(Display* dpy, Model* model) {
+	SearchContext* search = model->search;
+	XUnmapWindow(dpy, model->pagerWindow);
+	// A daemon is more likely to be killed than to exit
+	saveSnapshot(model);
+	model->hidden = 1;
+	model->mode = 0;
+	search->buffer[0] = '\0';
+	search->size = 0;
+	updateSearchContext(search, model->previews, model->classes);
+	if (model->currentDesktop >= 0 && model->currentDesktop < model->nWorkspaces)
+		model->selected = model->currentDesktop;
+	markAllWorkspaces(model);
+}
+
+// The back buffers already hold the current frame, mapping the window is
+// all there is to do.  The Exposes that follow copy it to the screen.
+void showPager(Display* dpy, Model* model) {
+	model->hidden = 0;
+	XMapRaised(dpy, model->pagerWindow);
+}
+
+// Another launch of a daemon's pager, sent by signalDaemon()
+char isDaemonMessage(Model* model, XEvent* event) {
+	return model->daemon && event->type == ClientMessage &&
+		event->xclient.message_type == model->atoms[ATOM_XDPAGER_TOGGLE];
+}
+
+// Tells a running daemon to show (or hide) its pager
+void signalDaemon(Display* dpy, Atom* atoms, Window daemon) {
+	XEvent e;
+	memset(&e, 0, sizeof(e));
+	e.xclient.type = ClientMessage;
+	e.xclient.window = daemon;
+	e.xclient.message_type = atoms[ATOM_XDPAGER_TOGGLE];
+	e.xclient.format = 32;
+	XSendEvent(dpy, daemon, False, NoEventMask, &e);
+}
+
+// handleEvent(), except a daemon hides where it would exit
+int dispatchEvent(Display* dpy, int screen, Model* model, XEvent* event) {
+	if (isDaemonMessage(model, event)) {
+		if (model->hidden)
+			showPager(dpy, model);
+		else
+			hidePager(dpy, model);
+		return 0;
+	}
+	// Another daemon took over
+	if (model->daemon && event->type == SelectionClear)
+		return 1;
+	if (!handleEvent(dpy, screen, model, event))
+		return 0;
+	if (!model->daemon)
+		return 1;
+	hidePager(dpy, model);
+	return 0;
+}
+
+// Thumbnails for exactly the mapped previews on the workspaces we show
+void syncThumbnails(Display* dpy, Model* model) {
+	thumbnails* t = model->thumbs;
+	PreviewSet* previews = model->previews;
+	unsigned long generation = ++t->generation;
+	for (int i=0; i<previews->bucketStart[model->nWorkspaces]; i++) {
+		MiniWindow* mw = previews->window[i];
+		if (!mw->mapped || mw->windowId == model->pagerWindow)
+			continue;
+		thumbnail* th = thumbs_get(t, mw->windowId);
+		if (th == NULL) {
+			th = thumbs_add(t, mw->windowId);
+			if (th == NULL)
+				continue;
+			// Live again, the still is out of date
+			if (model->stills)
+				thumbcache_remove(model->stills, mw->windowId);
+			markWorkspace(model, mw->previewedOn);
+		}
+		th->workspace = mw->previewedOn;
+		th->generation = generation;
+	}
+
+	darray* stale = darray_create(sizeof(Window));
+	for (int i=0; i<t->windows->capacity; i++) {
+		thumbnail* th = t->windows->values[i];
+		if (t->windows->keys[i] != 0 && th->generation != generation)
+			darray_addBack(stale, &th->window);
+	}
+	for (int i=0; i<stale->size; i++) {
+		Window w = DARRAY_AT(stale, Window, i);
+		MiniWindow* mw = wtable_get(model->windows, w);
+		// Unmapped but still around, keep what it looked like last
+		if (model->stills && mw != NULL && !mw->mapped) {
+			XImage* image = thumbs_capture(t, thumbs_get(t, w), mw->w, mw->h, mw->rw, mw->rh);
+			if (image != NULL) {
+				thumbcache_put(model->stills, w, image);
+				XDestroyImage(image);
+			}
+		}
+		thumbs_remove(t, w);
+	}
+	darray_free(stale);
+}
+
+// Repaint the thumbnails that were drawn to, unless they were repainted less
+// than an interval ago.  Those are remembered for the event loop to wake up for.
+void markDueThumbnails(Model* model) {
+	thumbnails* t = model->thumbs;
+	long now = thumbs_now();
+	t->nextDue = -1;
+	for (int i=0; i<t->windows->capacity; i++) {
+		thumbnail* th = t->windows->values[i];
+		if (t->windows->keys[i] == 0 || !th->damaged)
+			continue;
+		long due = th->lastDrawn + t->interval;
+		if (due <= now)
+			markWorkspace(model, th->workspace);
+		else if (t->nextDue < 0 || due < t->nextDue)
+			t->nextDue = due;
+	}
+}
+
+// Do everything the last batch of events asked for, once
+void flushDirty(Display* dpy, int screen, Model* model) {
+	Dirty* d = model->dirty;
+
+	if (d->layout)
+		handleResize(dpy, screen, model);
+	if (d->model)
+		rebuildPreviews(model);
+	if (model->thumbs) {
+		if (d->model)
+			syncThumbnails(dpy, model);
+		markDueThumbnails(model);
+	}
+	// Nothing points at untracked windows anymore.  Once they make up
+	// most of the snapshot, reclaim their space.
+	if (model->garbage > ARENA_BLOCK_SIZE && model->garbage > model->snapshot->used / 2)
+		compactWindows(model);
+
+	// A hidden pager keeps drawing into its back buffers, only presenting waits
+	if (anyWorkspaceDirty(model))
+		redraw(dpy, screen, MARGIN, model->gfx, model);
+
+	d->model = 0;
+	d->layout = 0;
+	d->fonts = 0;
+	memset(d->workspaces, 0, ((model->nWorkspaces + LONG_BITS - 1) / LONG_BITS) * sizeof(unsigned long));
+}
+
+// Startup phases, printed with the timings option once the first frame is out
+#define MAX_PHASES 16
+char* phaseNames[MAX_PHASES];
+double phaseTimes[MAX_PHASES]; // ms
+int nPhases;
+struct timespec phaseStart;
+
+// Ends the current phase as name, NULL starts the clock
+void timePhase(char* name) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	if (name != NULL && nPhases < MAX_PHASES) {
+		phaseNames[nPhases] = name;
+		phaseTimes[nPhases++] = (now.tv_sec - phaseStart.tv_sec) * 1e3 + (now.tv_nsec - phaseStart.tv_nsec) / 1e6;
+	}
+	phaseStart = now;
+}
+
+void printPhases() {
+	double total = 0;
+	for (int i=0; i<nPhases; i++) {
+		printf("%-14s %8.2f ms\n", phaseNames[i], phaseTimes[i]);
+		total += phaseTimes[i];
+	}
+	printf("%-14s %8.2f ms\n", "total", total);
+}
+
 int main(int argc, char *argv[]) {
+	timePhase(NULL);
+	Display *dpy = XOpenDisplay(NULL);
+	if (dpy == NULL) {
+		fprintf(stderr, "Can't open display\n");
+		exit(1);
+	}
+
+	// Intern every atom we need up front in a single request
+	Atom* atoms = internAtoms(dpy);
+
+	// With a daemon around, launching is just asking it to show up
+	Window daemon = XGetSelectionOwner(dpy, atoms[ATOM_XDPAGER_DAEMON]);
+	if (daemon != None) {
+		signalDaemon(dpy, atoms, daemon);
+		XCloseDisplay(dpy);
+		free(atoms);
+		return 0;
+	}
+
+	timePhase("connect");
+
 	XDConfig* cfg = getConfig(argc,argv);
+	showTimings = cfg->timings;
 	if (cfg->navType)
 		navType = cfg->navType;
 	if (cfg->margin)
 		MARGIN = cfg->margin;
 
 	XSetErrorHandler(errorHandler);
-	Display *dpy;
+	timePhase("config");
 	int screen;
 	Visual* visual;
 	Window win;
@@ -933,73 +2353,108 @@ int main(int argc, char *argv[]) {
 	// Config options
 	unsigned short nWorkspaces = cfg->nDesktops;      // Number of workspaces/desktops
 	unsigned short workspacesPerRow = cfg->desktopsPerRow;
-	unsigned short maxWindows = 30;      // Maximum number of windows to preview (TODO: dynamic arrays)
 
 	SearchContext* search = malloc(sizeof(SearchContext));
-	search->buffer = malloc(20 * sizeof(char)); // buffer for searching by text
+	search->capacity = 32;
+	search->buffer = malloc(search->capacity * sizeof(char)); // buffer for searching by text, grows as needed
+	search->buffer[0] = '\0';
 	search->selectedWindow = NULL;		// Give it a sensible default instead of random memory
-	search->matchedWindows = malloc(maxWindows * sizeof(MiniWindow*)); // array for windows that match search string
-								       // Overeager alloc, but lol dynamic arrays
-	search->nMatched = 0;			// length of matchedWindows
+	search->matchedWindows = darray_create(sizeof(MiniWindow*)); // windows that match search string
+	search->classMatched = darray_create(sizeof(char));
 	search->size = 0;
 	search->prefix = "";
 
-	dpy = XOpenDisplay(NULL);
-	if (dpy == NULL) {
-		fprintf(stderr, "Can't open display\n");
-		exit(1);
-	}
-
 	screen = DefaultScreen(dpy);
 	visual = DefaultVisual(dpy,screen);
 
 	// Get Multihead geometry for coordinate normalization
-	llist* monitors = getMonitors(dpy);
+	darray* monitors = getMonitors(dpy);
 
 	// Set Root window to notify us of its child windows' events
 	XSetWindowAttributes attrs;
-	attrs.event_mask = SubstructureNotifyMask;
+	attrs.event_mask = SubstructureNotifyMask | PropertyChangeMask;
 	XChangeWindowAttributes(dpy,DefaultRootWindow(dpy),CWEventMask,&attrs);
 
 	// Get the desktop we're currently on
 	// TODO: Xinerama to determine where we actually are
-	int currentDesktop = getCurrentDesktop(dpy);
+	int currentDesktop = getCurrentDesktop(dpy, atoms);
 
 	int width_old = cfg->width;
 	int height_old = cfg->height;
-	win = createMainWindow(dpy,screen, nWorkspaces, workspacesPerRow, cfg);
+	win = createMainWindow(dpy,screen, atoms, nWorkspaces, workspacesPerRow, cfg);
 	
 	// TODO colors as configureable options.  Formatting
 	GfxContext* colorsCtx = initColors(dpy, screen, cfg);
 
 	// If no font provided for windows, use the regular font
-	// This saves some parsing time when we have to reload fonts
-	colorsCtx->fonts = llist_create();
-	colorsCtx->wFonts = (cfg->windowFont == NULL) ? colorsCtx->fonts : llist_create();
+	// Font strings are parsed once here, sizes change with the layout
+	colorsCtx->fonts = fontlist_create();
+	fontlist_parse(colorsCtx->fonts, cfg->font);
+	colorsCtx->wFonts = colorsCtx->fonts;
+	if (cfg->windowFont != NULL) {
+		colorsCtx->wFonts = fontlist_create();
+		fontlist_parse(colorsCtx->wFonts, cfg->windowFont);
+	}
+	// Enough to go back and forth between a few layouts without reopening
+	colorsCtx->fontCache = fontcache_create(4 * (colorsCtx->fonts->specs->size + colorsCtx->wFonts->specs->size),
+			fontdisk_create());
 
 	// Create child windows for each workspace
 	// Don't necessarily need child windows, but we don't have to keep track of separate offsets this way
 	// (preserve 16:9 ratio)
-	Window* workspaces = malloc(nWorkspaces * sizeof(Window));
-	XftDraw** draws = malloc(nWorkspaces * sizeof(XftDraw*));
+	// The single surface renderer draws everything into the main window instead,
+	// and so does the software one, without any server side buffers
+	char renderer = cfg->renderer == RENDER_SINGLE ? RENDER_SINGLE : RENDER_WINDOWS;
+	softsurface* soft = NULL;
+	if (cfg->renderer == RENDER_SOFTWARE) {
+		soft = soft_create(dpy, screen);
+		if (soft != NULL) {
+			renderer = RENDER_SOFTWARE;
+		} else {
+			puts("Visual not supported by the software renderer, using renderer 1");
+			renderer = RENDER_SINGLE;
+		}
+	}
+	int nBuffers = renderer == RENDER_SINGLE ? 1 : renderer == RENDER_SOFTWARE ? 0 : nWorkspaces;
+	Window* workspaces = NULL;
+	Pixmap* buffers = malloc(nBuffers * sizeof(Pixmap));
+	XftDraw** draws = malloc(nBuffers * sizeof(XftDraw*));
 	int i;
 	int width = 160;
 	int height = 90;
-	for (i=0;i<nWorkspaces;++i) {
+	if (renderer != RENDER_WINDOWS) {
+		XSelectInput(dpy, win, ExposureMask | KeyPressMask | ButtonPressMask | ButtonReleaseMask | PointerMotionMask);
+		XSetWindowBackgroundPixmap(dpy, win, None);
+	}
+	if (renderer == RENDER_SINGLE) {
+		// Sized for real by the first handleResize()
+		buffers[0] = XCreatePixmap(dpy, win, 1, 1, DefaultDepth(dpy, screen));
+		draws[0] = XftDrawCreate(dpy,buffers[0],visual,DefaultColormap(dpy,screen));
+	} else if (renderer == RENDER_WINDOWS) {
+		workspaces = malloc(nWorkspaces * sizeof(Window));
+	}
+	for (i=0;renderer == RENDER_WINDOWS && i<nWorkspaces;++i) {
 		int width = 160;
 		int height = 90;
 		int x =  ((i%workspacesPerRow) * (width + MARGIN)) + MARGIN;
 		int y =  ((i/workspacesPerRow) * (height + MARGIN))+ MARGIN;
 		workspaces[i] = XCreateSimpleWindow(dpy, win, x, y, width, height, 1, BlackPixel(dpy, screen), WhitePixel(dpy, screen));
 		XSelectInput(dpy, workspaces[i], ExposureMask | ButtonPressMask | ButtonReleaseMask | PointerMotionMask);
+		// Everything shown is copied from the back buffer, don't let the server clear to white first
+		XSetWindowBackgroundPixmap(dpy, workspaces[i], None);
 		XMapWindow(dpy, workspaces[i]);
 
-		// Create Xft draw surface for text per window so we don't have to keep track of window position offsets
-		draws[i] = XftDrawCreate(dpy,workspaces[i],visual,DefaultColormap(dpy,screen));
+		// Create Xft draw surface for text per back buffer so we don't have to keep track of window position offsets
+		buffers[i] = XCreatePixmap(dpy, workspaces[i], width, height, DefaultDepth(dpy, screen));
+		draws[i] = XftDrawCreate(dpy,buffers[i],visual,DefaultColormap(dpy,screen));
 	}
 
-	// Get readable workspace names 
-	char** workspaceNames = getWorkspaceNames(dpy, screen, nWorkspaces);
+	// Get readable workspace names, the ones from last time for now if there was a last time
+	char* snapPath = snapfile_path();
+	snapfile* snap = snapPath ? snapfile_open(snapPath) : NULL;
+	free(snapPath);
+	char** workspaceNames = snap ? restoreWorkspaceNames(snap, nWorkspaces) :
+		getWorkspaceNames(dpy, atoms, screen, nWorkspaces);
 
 	// Size/scale info
 	Sizing* s = malloc(sizeof(Sizing));
@@ -1008,180 +2463,181 @@ int main(int argc, char *argv[]) {
 	s->previewWidth = width;
 	s->previewHeight = height;	
 
-	// Allocate an array of the actual windows to draw.
-	// Geometry for each set of windows should be relative to its display's origin
-	llist* miniWindows = testX(dpy, s, monitors);
-
 	// Collect all this shit together for organization
 	Model* model = malloc(sizeof(Model));
+	model->atoms = atoms;
+	model->clientListMode = cfg->clientList;
+	model->useClientList = 0;
 	model->monitors = monitors;
 	model->workspaces = workspaces;
 	model->workspaceNames = workspaceNames;
+	model->renderer = renderer;
+	model->buffers = buffers;
 	model->draws = draws;
+	model->soft = soft;
+	model->thumbs = NULL;
+	if (cfg->thumbnails && renderer == RENDER_SOFTWARE)
+		puts("Thumbnails are drawn by the server, they don't work with renderer 2");
+	else if (cfg->thumbnails)
+		model->thumbs = thumbs_create(dpy, screen, cfg->thumbnails);
+	model->stills = NULL;
+	if (model->thumbs && cfg->thumbnailCache) {
+		model->stills = thumbcache_create(dpy, screen, (size_t)cfg->thumbnailCache << 20);
+		if (model->stills == NULL)
+			puts("Visual not supported by the thumbnail cache, hidden windows stay flat");
+	}
 	model->nWorkspaces = nWorkspaces;
-	model->previews = miniWindows;
+	model->stack = darray_create(sizeof(MiniWindow*));
+	model->windows = wtable_create();
+	model->previews = previewSet_create(nWorkspaces);
+	model->classes = darray_create(sizeof(char*));
 	model->selected = currentDesktop;
 	model->search = search;
-	model->mainWindow = workspaces[0];
+	model->mainWindow = workspaces ? workspaces[0] : win;
+	model->pagerWindow = win;
+	model->currentDesktop = currentDesktop;
+	model->daemon = 0;
+	model->hidden = 0;
+	if (cfg->daemon) {
+		XSetSelectionOwner(dpy, atoms[ATOM_XDPAGER_DAEMON], win, CurrentTime);
+		if (XGetSelectionOwner(dpy, atoms[ATOM_XDPAGER_DAEMON]) == win) {
+			model->daemon = 1;
+			model->hidden = 1;
+		} else {
+			puts("Couldn't become the daemon, running once");
+			XMapWindow(dpy, win);
+		}
+	}
 	model->mode = 0;
 	model->windowTextMode = 0;
 	model->workspacesPerRow = workspacesPerRow;
 	model->sizing = s;
 	model->gfx = colorsCtx;
-	model->rawFont = cfg->font;
-	model->rawWindowFont = cfg->windowFont;
-
-	handleResize(dpy, screen, model);
-
-	while(1) {
-		XNextEvent(dpy, &event);
-
-		// Window resize events
-		if (event.type == ConfigureNotify) {
-//			printf("ConfigureNotify %lx %lx (%d,%d,%d,%d) %lx\n", 
-//					event.xconfigure.window, event.xconfigure.event,
-//					event.xconfigure.x, event.xconfigure.y, 
-//					event.xconfigure.width, event.xconfigure.height,
-//					event.xconfigure.above);
-//			TODO: Ignore events from our child windows as they don't require redraws
-			if (event.xconfigure.window == win) {
-				// If our window has been resized, update the scale factors
-				int w = event.xconfigure.width;
-				int h = event.xconfigure.height; 
-				if (model->sizing->width != w || model->sizing->height != h) {
-					model->sizing->width = w;
-					model->sizing->height = h;
-					handleResize(dpy, screen, model);
-				} else {
-					cleanupList(model->previews);
-					model->previews = testX(dpy, model->sizing, model->monitors);
-				}
-			} else if (isWorkspaceWindow(workspaces, nWorkspaces, event.xconfigure.window)) {
-				printf("notify on child window 0x%lx\n", event.xconfigure.window);
-			} else {
-				// Some other window has changed size
-				// Don't need to update our layout or scaling, just the list of previews
-				cleanupList(model->previews);
-				model->previews = testX(dpy, model->sizing, model->monitors);
-			}
-			redraw(dpy,screen,MARGIN,colorsCtx,model);
-		}
-
-		// Expose events
-		// Redraw fully only on the last damaged event
-		if (event.type == Expose && event.xexpose.count == 0) {
-			//printf("Expose event for %lx\n", event.xexpose.window);
-			redraw(dpy,screen,MARGIN,colorsCtx,model);
-			if (event.xany.window == win && navType == NAV_MOVE_WITH_SELECTION) {
-				grabFocus(win);
-			}
-		}
-
-		// Destroy events
-		// Redraw if a window we know about is destroyed
-		// Reason for filtering is we get DestroyNotify events for non-relevant
-		// sub-windows that cause useless redraws.
-		if (event.type == DestroyNotify) {
-			node* ptr = model->previews->head;
-			while (ptr != NULL) {
-				MiniWindow* mw = (MiniWindow*) ptr->data;
-				if (mw->windowId == event.xdestroywindow.window) {
-					break;
-				}
-				ptr = ptr->next;
-			}
-			if (ptr != NULL) {
-				cleanupList(model->previews);
-				model->previews = testX(dpy, model->sizing, model->monitors);
-				redraw(dpy,screen,MARGIN,colorsCtx,model);
-			}
-		}
-
-		// Key events
-		if (event.type == KeyPress) {
-			KeySym sym = XLookupKeysym(&event.xkey, 0);
-			//printf("keycode %d %s\n", event.xkey.keycode, XKeysymToString(sym));
-			int shouldExit = 0;
-			switch(model->mode) {
-				case 0:
-					shouldExit = workspaceKey(sym, model, dpy, screen, win);
-					break;
-				case 1:
-					shouldExit = searchKey(sym, model, colorsCtx);
-					break;
-				default: 
-					printf("Unknown mode %d\n",model->mode);
-					shouldExit = 1;
-					break;
-			}
-			if (shouldExit == 1)
-				break; // goto cleanup
-			else {
-				redraw(dpy,screen,MARGIN,colorsCtx,model);
-				if (navType == NAV_MOVE_WITH_SELECTION) {
-					grabFocus(win);
-				}
-			}
-		}
-		
-		// Mouse movement
-		// Mouse selection of filtered windows not implemented. Would need to do geometry range checking
-		if (event.type == MotionNotify && model->mode == 0) {
-			int pWorkspace = findPointerWorkspace(event.xmotion.window, workspaces, nWorkspaces);
-			if (pWorkspace != model->selected){
-				model->selected = pWorkspace;
-				redraw(dpy,screen,MARGIN,colorsCtx,model);
-				if (navType == NAV_MOVE_WITH_SELECTION) {
-					switchDesktop(model->selected);
-					grabFocus(win);
-				} else if (navType == NAV_MOVE_WITH_SELECTION_EXPERIMENTAL) {
-					setDesktopForWindow(win, model->selected);
-					activateWindow(win);
-				}
-			}
+	model->dirty = malloc(sizeof(Dirty));
+	model->dirty->model = 0;
+	model->dirty->layout = 0;
+	model->dirty->fonts = 1; // nothing is open yet
+	model->dirty->workspaces = calloc((nWorkspaces + LONG_BITS - 1) / LONG_BITS, sizeof(unsigned long));
+	model->snapshot = arena_create();
+	model->spare = arena_create();
+	model->garbage = 0;
+	model->pixelsize = 0;
+
+	timePhase("setup");
+
+	// The layout decides the font size.  Fonts are matched on a worker
+	// while the window table is built here, then opened for the first frame.
+	// Afterwards the table is kept up to date from events.
+	// Geometry for each set of windows should be relative to its display's origin
+	// With a snapshot and every font resolved by an earlier launch, the first
+	// frame is drawn from the snapshot before the server is asked about
+	// anything, then corrected.
+	resizeWorkspaceWindows(dpy, model);
+	if (snap && fontsOnDisk(colorsCtx, fontPixelsize(s))) {
+		restoreSnapshotWindows(model, snap);
+		reloadFonts(model, dpy, screen);
+		markAllWorkspaces(model);
+		timePhase("snapshot");
+		flushDirty(dpy, screen, model);
+		XFlush(dpy);
+		timePhase("snapshot frame");
+		reconcileSnapshot(dpy, model);
+		timePhase("windows");
+	} else {
+		fontmatch* matching = fontmatch_start(dpy, screen, colorsCtx->fontCache->disk,
+				colorsCtx->fonts->specs, colorsCtx->wFonts->specs, fontPixelsize(s));
+		timePhase("layout");
+		resyncWindows(dpy, model);
+		if (snap)
+			reconcileWorkspaceNames(dpy, model);
+		timePhase("windows");
+		fontmatch_finish(matching, colorsCtx->fontCache, dpy);
+		timePhase("font matching");
+		reloadFonts(model, dpy, screen);
+		markAllWorkspaces(model);
+		timePhase("font opening");
+	}
+	if (snap)
+		snapfile_close(snap);
+	model->dirty->model = 1; // thumbnails follow the previews
+	flushDirty(dpy, screen, model);
+	if (showTimings) {
+		XSync(dpy, False); // so the frame's requests are counted too
+		timePhase("first frame");
+		printPhases();
+	}
+	// Whatever had to be matched for it is known from now on
+	fontdisk_save(colorsCtx->fontCache->disk);
+
+	char shouldExit = 0;
+	while(!shouldExit) {
+		// Thumbnails held back by their interval are painted once it's over,
+		// even if nothing else happens by then
+		if (model->thumbs && !thumbs_wait(dpy, thumbs_timeout(model->thumbs))) {
+			flushDirty(dpy, screen, model);
+			continue;
 		}
-
-		// If a childwindow is clicked, move to the workspace
-		if (event.type == ButtonRelease && model->mode == 0) {
-			for (i=0;i<nWorkspaces;++i) {
-				if (event.xany.window == workspaces[i]) {
-					break;
-				}
-			}
-			if (i < nWorkspaces) {
-				// Assumes desktop numbers are at most double digit
-				char command[23*sizeof(char)];
-				sprintf(command, "xdotool set_desktop %d", i);
-				system(command);
-			}
-			// Always termiante even if we don't move
-			break;
+		// Block until something happens, then drain everything already queued
+		// behind it so that a burst of events costs a single update and redraw
+		XNextEvent(dpy, &event);
+		shouldExit = dispatchEvent(dpy, screen, model, &event);
+		while (!shouldExit && XPending(dpy)) {
+			XNextEvent(dpy, &event);
+			shouldExit = dispatchEvent(dpy, screen, model, &event);
 		}
-
+		if (!shouldExit)
+			flushDirty(dpy, screen, model);
 	}
 
 
 	// Cleanup
+	saveSnapshot(model);
 	XftColorFree(dpy,visual,DefaultColormap(dpy,screen),colorsCtx->fontColor);
 	XFreeColors(dpy,DefaultColormap(dpy,screen),colorsCtx->pixels,3,0l);
 	XFree(colorsCtx->normal);
 	XFree(colorsCtx->selected);
 	XFree(colorsCtx->workspace);
 	XFree(colorsCtx->matched);
+	rectbatch_free(colorsCtx->batch);
+	darray_free(colorsCtx->batchText);
 	free(colorsCtx->pixels);
 	free(colorsCtx);
 
 //	free(model->previews);
+	for(i=0;i<nBuffers;++i) {
+		XftDrawDestroy(model->draws[i]);
+		XFreePixmap(dpy, model->buffers[i]);
+	}
+	free(model->draws);
+	free(model->buffers);
+	if (model->soft)
+		soft_free(model->soft);
+	if (model->thumbs)
+		thumbs_free(model->thumbs);
+	if (model->stills)
+		thumbcache_free(model->stills);
 	free(model->workspaces);
 	for(i=0;i<nWorkspaces;++i) {
 		free(model->workspaceNames[i]);
 	}
 	free(model->workspaceNames);
 	free(model->search->buffer);
+	darray_free(model->search->classMatched);
+	darray_free(model->search->matchedWindows);
 	free(model->search);
+	darray_free(model->stack);
+	previewSet_free(model->previews);
+	for (i=0; i<model->classes->size; ++i)
+		free(DARRAY_AT(model->classes, char*, i));
+	darray_free(model->classes);
+	wtable_free(model->windows);
+	arena_free(model->snapshot);
+	arena_free(model->spare);
+	free(model->dirty->workspaces);
+	free(model->dirty);
+	free(model->atoms);
 	free(model);
 
-	cleanupList(miniWindows);
 	if (cfg->searchPrefix)
 		free(cfg->searchPrefix);
 	if (cfg->dockType)
@@ -1195,7 +2651,8 @@ int main(int argc, char *argv[]) {
 	//if (cfg->fontColor)
 	//	free(cfg->fontColor);
 	
-	free(monitors); // TODO: genericize cleanupList 
+	darray_free(monitors);
 	free(cfg);
+	XCloseDisplay(dpy); // flushes whatever is still queued
 	return 0;
 }
@@ -7,18 +7,18 @@ typedef struct {
 	int height;
 } Monitor;
 
-llist* getMonitors(Display* dpy) {
+darray* getMonitors(Display* dpy) {
 	int nMonitors;
 	XineramaScreenInfo* screens = XineramaQueryScreens(dpy, &nMonitors);
-	llist* list = llist_create();
+	darray* list = darray_create(sizeof(Monitor));
 	for (int i=0; i<nMonitors; i++) {
 		printf("monitor %d+%d %dx%d\n", screens[i].x_org, screens[i].y_org, screens[i].width, screens[i].height);
-		Monitor* mon = malloc(sizeof(Monitor));
-	       	mon->x_offset = screens[i].x_org;
-		mon->y_offset = screens[i].y_org;
-		mon->width = screens[i].width;
-		mon->height = screens[i].height;
-		llist_addBack(list, mon);
+		Monitor mon;
+	       	mon.x_offset = screens[i].x_org;
+		mon.y_offset = screens[i].y_org;
+		mon.width = screens[i].width;
+		mon.height = screens[i].height;
+		darray_addBack(list, &mon);
 	}
 
 	XFree(screens);
@@ -0,0 +1,88 @@
+// Collects rectangles per GC so a whole set of them goes out in one
+// XFillRectangles/XDrawRectangles request per GC instead of one request per
+// rectangle.  Rectangles in one batch never overlap, which makes the order
+// they end up drawn in irrelevant: a rectangle that would overlap a pending
+// one has to wait for the next batch, so stacking order is kept.
+
+#define RECTBATCH_MAX_GCS 8
+
+typedef struct {
+	int nGCs;
+	GC gcs[RECTBATCH_MAX_GCS];
+	darray* fills[RECTBATCH_MAX_GCS];    // XRectangle, per gc
+	darray* outlines[RECTBATCH_MAX_GCS]; // XRectangle, per gc
+	darray* pending; // XRectangle, the area of everything in the batch
+} rectbatch;
+
+rectbatch* rectbatch_create() {
+	rectbatch* b = malloc(sizeof(rectbatch));
+	b->nGCs = 0;
+	b->pending = darray_create(sizeof(XRectangle));
+	return b;
+}
+
+static int rectbatch_slot(rectbatch* b, GC gc) {
+	for (int i=0; i<b->nGCs; i++) {
+		if (b->gcs[i] == gc)
+			return i;
+	}
+	if (b->nGCs == RECTBATCH_MAX_GCS) {
+		puts("Uh oh rectbatch_slot");
+		exit(1);
+	}
+	b->gcs[b->nGCs] = gc;
+	b->fills[b->nGCs] = darray_create(sizeof(XRectangle));
+	b->outlines[b->nGCs] = darray_create(sizeof(XRectangle));
+	return b->nGCs++;
+}
+
+// Only the insides count.  An outline covers one pixel more than its width
+// and height, so neighbouring tiles share an edge pixel; letting that edge
+// be an outline rather than a fill keeps tiled layouts in a single batch.
+static char rectbatch_intersects(XRectangle* a, XRectangle* b) {
+	return a->x < b->x + b->width && b->x < a->x + a->width &&
+		a->y < b->y + b->height && b->y < a->y + a->height;
+}
+
+// Whether r has to wait until the pending rectangles are drawn
+char rectbatch_overlaps(rectbatch* b, XRectangle r) {
+	for (int i=0; i<b->pending->size; i++) {
+		if (rectbatch_intersects(&DARRAY_AT(b->pending, XRectangle, i), &r))
+			return 1;
+	}
+	return 0;
+}
+
+// Queues r to be filled with fillGC and outlined with outlineGC
+void rectbatch_add(rectbatch* b, XRectangle r, GC fillGC, GC outlineGC) {
+	darray_addBack(b->fills[rectbatch_slot(b, fillGC)], &r);
+	darray_addBack(b->outlines[rectbatch_slot(b, outlineGC)], &r);
+	darray_addBack(b->pending, &r);
+}
+
+// All fills go before all outlines, so that an outline is never painted
+// over by a neighbour's fill
+void rectbatch_flush(rectbatch* b, Display* dpy, Drawable d) {
+	for (int i=0; i<b->nGCs; i++) {
+		darray* fills = b->fills[i];
+		if (fills->size > 0)
+			XFillRectangles(dpy, d, b->gcs[i], (XRectangle*)fills->data, fills->size);
+		darray_clear(fills);
+	}
+	for (int i=0; i<b->nGCs; i++) {
+		darray* outlines = b->outlines[i];
+		if (outlines->size > 0)
+			XDrawRectangles(dpy, d, b->gcs[i], (XRectangle*)outlines->data, outlines->size);
+		darray_clear(outlines);
+	}
+	darray_clear(b->pending);
+}
+
+void rectbatch_free(rectbatch* b) {
+	for (int i=0; i<b->nGCs; i++) {
+		darray_free(b->fills[i]);
+		darray_free(b->outlines[i]);
+	}
+	darray_free(b->pending);
+	free(b);
+}
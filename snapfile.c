@@ -0,0 +1,172 @@
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// What the pager showed last time, saved on exit so the next launch can
+// draw its first frame before asking the server anything.  The file is
+// mapped as is: a header, fixed size records, and the strings they point
+// to.  A string is an offset into the string area, whose first byte is
+// always a terminator so that offset 0 stands for NULL.  Written in native
+// byte order, the file never leaves the machine.
+
+#define SNAPFILE_MAGIC "XDPS"
+#define SNAPFILE_VERSION 2
+
+typedef struct {
+	char magic[4];
+	uint32_t version;
+	uint32_t size;        // of the whole file
+	uint32_t nWorkspaces; // names
+	uint32_t nWindows;
+	uint32_t stringsSize;
+} snapHeader;
+
+// A previewed window, in preview order
+typedef struct {
+	uint64_t windowId;
+	int32_t workspace;
+	int32_t rx; // root geometry, scaled again for the current layout
+	int32_t ry;
+	int32_t rw;
+	int32_t rh;
+	int32_t state;
+	int32_t mapped;
+	uint32_t className;
+	uint32_t name;
+} snapWindow;
+
+typedef struct {
+	char* data;
+	size_t size;
+	snapHeader* header;
+	snapWindow* windows;
+	uint32_t* names; // per workspace
+	char* strings;
+} snapfile;
+
+char* snapfile_path() {
+	return cachePath("snapshot");
+}
+
+// NULL if there's no snapshot or it doesn't look like one of ours
+snapfile* snapfile_open(char* path) {
+	int fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return NULL;
+	struct stat st;
+	if (fstat(fd, &st) < 0 || st.st_size < sizeof(snapHeader)) {
+		close(fd);
+		return NULL;
+	}
+	char* data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED)
+		return NULL;
+
+	snapfile* f = malloc(sizeof(snapfile));
+	f->data = data;
+	f->size = st.st_size;
+	f->header = (snapHeader*)data;
+	snapHeader* h = f->header;
+	size_t fixed = sizeof(snapHeader) + (size_t)h->nWindows * sizeof(snapWindow) +
+		(size_t)h->nWorkspaces * sizeof(uint32_t);
+	// The string area has to end in a terminator for every string in it to
+	if (memcmp(h->magic, SNAPFILE_MAGIC, 4) != 0 || h->version != SNAPFILE_VERSION ||
+			h->size != f->size || h->stringsSize == 0 || fixed + h->stringsSize != f->size ||
+			data[f->size - 1] != '\0') {
+		munmap(data, f->size);
+		free(f);
+		return NULL;
+	}
+	f->windows = (snapWindow*)(data + sizeof(snapHeader));
+	f->names = (uint32_t*)(f->windows + h->nWindows);
+	f->strings = data + fixed;
+	return f;
+}
+
+// NULL for offset 0 or anything outside of the string area
+char* snapfile_string(snapfile* f, uint32_t offset) {
+	if (offset == 0 || offset >= f->header->stringsSize)
+		return NULL;
+	return f->strings + offset;
+}
+
+void snapfile_close(snapfile* f) {
+	munmap(f->data, f->size);
+	free(f);
+}
+
+typedef struct {
+	darray* windows; // snapWindow
+	darray* names;   // uint32_t
+	darray* strings; // char
+} snapwriter;
+
+snapwriter* snapwriter_create() {
+	snapwriter* w = malloc(sizeof(snapwriter));
+	w->windows = darray_create(sizeof(snapWindow));
+	w->names = darray_create(sizeof(uint32_t));
+	w->strings = darray_create(sizeof(char));
+	char nul = '\0';
+	darray_addBack(w->strings, &nul);
+	return w;
+}
+
+uint32_t snapwriter_string(snapwriter* w, char* str) {
+	if (str == NULL)
+		return 0;
+	uint32_t offset = w->strings->size;
+	int len = strlen(str) + 1;
+	darray_reserve(w->strings, w->strings->size + len);
+	memcpy((char*)w->strings->data + w->strings->size, str, len);
+	w->strings->size += len;
+	return offset;
+}
+
+void snapwriter_addWindow(snapwriter* w, snapWindow* window) {
+	darray_addBack(w->windows, window);
+}
+
+void snapwriter_addName(snapwriter* w, char* name) {
+	uint32_t offset = snapwriter_string(w, name);
+	darray_addBack(w->names, &offset);
+}
+
+static char snapwriter_write(int fd, darray* a) {
+	return write(fd, a->data, a->size * a->elemSize) == (ssize_t)(a->size * a->elemSize);
+}
+
+// Replaces the file at path in one go, a reader never sees half of it
+char snapwriter_save(snapwriter* w, char* path) {
+	makeCacheDir(path);
+	char tmp[strlen(path) + 5];
+	sprintf(tmp, "%s.tmp", path);
+	int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0)
+		return 0;
+	snapHeader h;
+	memcpy(h.magic, SNAPFILE_MAGIC, 4);
+	h.version = SNAPFILE_VERSION;
+	h.nWorkspaces = w->names->size;
+	h.nWindows = w->windows->size;
+	h.stringsSize = w->strings->size;
+	h.size = sizeof(snapHeader) + h.nWindows * sizeof(snapWindow) + h.nWorkspaces * sizeof(uint32_t) +
+		h.stringsSize;
+	char ok = write(fd, &h, sizeof(h)) == sizeof(h) &&
+		snapwriter_write(fd, w->windows) && snapwriter_write(fd, w->names) &&
+		snapwriter_write(fd, w->strings);
+	close(fd);
+	if (!ok || rename(tmp, path) < 0) {
+		unlink(tmp);
+		return 0;
+	}
+	return 1;
+}
+
+void snapwriter_free(snapwriter* w) {
+	darray_free(w->windows);
+	darray_free(w->names);
+	darray_free(w->strings);
+	free(w);
+}
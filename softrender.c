@@ -0,0 +1,328 @@
+#include <sys/ipc.h>
+#include <sys/shm.h>
+#include <X11/extensions/XShm.h>
+
+// Client side rasterizer for the whole pager.  Frames are drawn into a
+// 32 bit buffer in our own memory and handed to the server as one image per
+// dirty cell, through a shared memory segment if the server supports MIT-SHM
+// (no copy through the socket), or with a plain XPutImage otherwise.
+// Rectangles are row spans of a single pixel value, filled four pixels per
+// 16 byte store.  Glyphs are rendered by FreeType once into coverage
+// bitmaps and blended from then on.
+// Only 24/32 bit TrueColor visuals with 8 bits per channel are supported,
+// which is what pixel values are written as.
+
+typedef struct {
+	int width;
+	int height;
+	int left; // from the pen position to the first column
+	int top;  // from the baseline up to the first row
+	unsigned char* coverage; // width * height, 0-255
+} softglyph;
+
+typedef struct {
+	Display* dpy;
+	Visual* visual;
+	int depth;
+	XImage* image;
+	XShmSegmentInfo shm;
+	char useShm;   // MIT-SHM available and attached
+	char inFlight; // the server may still be reading the segment
+	uint32_t* pixels;
+	int stride; // in pixels
+	int width;
+	int height;
+	XRectangle clip;
+	wtable* fonts; // XftFont* to a wtable of glyph id + 1 to softglyph*
+} softsurface;
+
+static char soft_shmFailed;
+
+static int soft_shmErrorHandler(Display* dpy, XErrorEvent* e) {
+	soft_shmFailed = 1;
+	return 0;
+}
+
+// NULL if the default visual isn't something we can write pixels for
+softsurface* soft_create(Display* dpy, int screen) {
+	Visual* visual = DefaultVisual(dpy, screen);
+	int depth = DefaultDepth(dpy, screen);
+	if (visual->class != TrueColor || (depth != 24 && depth != 32) ||
+			visual->red_mask != 0xff0000 || visual->green_mask != 0xff00 || visual->blue_mask != 0xff)
+		return NULL;
+
+	softsurface* s = malloc(sizeof(softsurface));
+	s->dpy = dpy;
+	s->visual = visual;
+	s->depth = depth;
+	s->image = NULL;
+	s->useShm = XShmQueryExtension(dpy);
+	s->inFlight = 0;
+	s->pixels = NULL;
+	s->width = 0;
+	s->height = 0;
+	s->fonts = wtable_create();
+	return s;
+}
+
+static void soft_destroyImage(softsurface* s) {
+	if (s->image == NULL)
+		return;
+	if (s->useShm) {
+		XShmDetach(s->dpy, &s->shm);
+		XDestroyImage(s->image);
+		shmdt(s->shm.shmaddr);
+	} else {
+		XDestroyImage(s->image); // frees the pixels too
+	}
+	s->image = NULL;
+}
+
+// Shared memory only works with a local server, and XShmQueryExtension
+// doesn't tell, so try attaching and see whether the server complains
+static char soft_createShmImage(softsurface* s, int width, int height) {
+	s->image = XShmCreateImage(s->dpy, s->visual, s->depth, ZPixmap, NULL, &s->shm, width, height);
+	if (s->image == NULL)
+		return 0;
+	s->shm.shmid = shmget(IPC_PRIVATE, s->image->bytes_per_line * height, IPC_CREAT | 0600);
+	if (s->shm.shmid < 0) {
+		XDestroyImage(s->image);
+		s->image = NULL;
+		return 0;
+	}
+	s->shm.shmaddr = s->image->data = shmat(s->shm.shmid, NULL, 0);
+	s->shm.readOnly = False;
+
+	soft_shmFailed = 0;
+	XErrorHandler old = XSetErrorHandler(soft_shmErrorHandler);
+	XShmAttach(s->dpy, &s->shm);
+	XSync(s->dpy, False);
+	XSetErrorHandler(old);
+	// Gone as soon as both sides detach
+	shmctl(s->shm.shmid, IPC_RMID, NULL);
+
+	if (soft_shmFailed) {
+		XDestroyImage(s->image);
+		shmdt(s->shm.shmaddr);
+		s->image = NULL;
+		return 0;
+	}
+	return 1;
+}
+
+void soft_resize(softsurface* s, int width, int height) {
+	soft_destroyImage(s);
+	if (s->useShm && !soft_createShmImage(s, width, height)) {
+		puts("MIT-SHM unavailable, falling back to XPutImage");
+		s->useShm = 0;
+	}
+	if (!s->useShm) {
+		char* data = malloc(width * height * 4);
+		s->image = XCreateImage(s->dpy, s->visual, s->depth, ZPixmap, 0, data, width, height, 32, 0);
+	}
+	if (s->image == NULL || s->image->bits_per_pixel != 32) {
+		puts("Uh oh soft_resize");
+		exit(1);
+	}
+	s->pixels = (uint32_t*)s->image->data;
+	s->stride = s->image->bytes_per_line / 4;
+	s->width = width;
+	s->height = height;
+	s->clip = (XRectangle){0, 0, width, height};
+	s->inFlight = 0;
+}
+
+// Wait for the server to be done with the last frame before drawing over it
+void soft_begin(softsurface* s) {
+	if (s->inFlight) {
+		XSync(s->dpy, False);
+		s->inFlight = 0;
+	}
+}
+
+// Drawing outside of clip is dropped, clip is in turn limited to the surface
+void soft_setClip(softsurface* s, XRectangle clip) {
+	int x1 = clip.x < 0 ? 0 : clip.x;
+	int y1 = clip.y < 0 ? 0 : clip.y;
+	int x2 = clip.x + clip.width < s->width ? clip.x + clip.width : s->width;
+	int y2 = clip.y + clip.height < s->height ? clip.y + clip.height : s->height;
+	s->clip = (XRectangle){x1, y1, x2 > x1 ? x2 - x1 : 0, y2 > y1 ? y2 - y1 : 0};
+}
+
+void soft_fill(softsurface* s, int x, int y, int w, int h, uint32_t pixel) {
+	int x1 = x < s->clip.x ? s->clip.x : x;
+	int y1 = y < s->clip.y ? s->clip.y : y;
+	int x2 = x + w < s->clip.x + s->clip.width ? x + w : s->clip.x + s->clip.width;
+	int y2 = y + h < s->clip.y + s->clip.height ? y + h : s->clip.y + s->clip.height;
+	uint32_t quad[4] = {pixel, pixel, pixel, pixel};
+	for (int row=y1; row<y2; row++) {
+		uint32_t* span = s->pixels + row * s->stride;
+		int col = x1;
+		// A fixed size memcpy is a single 16 byte store
+		for (; col + 4 <= x2; col += 4)
+			memcpy(span + col, quad, sizeof(quad));
+		for (; col < x2; col++)
+			span[col] = pixel;
+	}
+}
+
+// Same pixels as XDrawRectangle: the outline is w + 1 by h + 1
+void soft_outline(softsurface* s, int x, int y, int w, int h, uint32_t pixel) {
+	soft_fill(s, x, y, w + 1, 1, pixel);
+	soft_fill(s, x, y + h, w + 1, 1, pixel);
+	soft_fill(s, x, y + 1, 1, h - 1, pixel);
+	soft_fill(s, x + w, y + 1, 1, h - 1, pixel);
+}
+
+static uint32_t soft_gcPixel(softsurface* s, GC gc) {
+	XGCValues values;
+	XGetGCValues(s->dpy, gc, GCForeground, &values); // no round trip, Xlib keeps these
+	return values.foreground;
+}
+
+// Draws and empties a batch in the same order rectbatch_flush() would
+void soft_flushBatch(softsurface* s, rectbatch* b) {
+	for (int i=0; i<b->nGCs; i++) {
+		uint32_t pixel = soft_gcPixel(s, b->gcs[i]);
+		for (int k=0; k<b->fills[i]->size; k++) {
+			XRectangle r = DARRAY_AT(b->fills[i], XRectangle, k);
+			soft_fill(s, r.x, r.y, r.width, r.height, pixel);
+		}
+		darray_clear(b->fills[i]);
+	}
+	for (int i=0; i<b->nGCs; i++) {
+		uint32_t pixel = soft_gcPixel(s, b->gcs[i]);
+		for (int k=0; k<b->outlines[i]->size; k++) {
+			XRectangle r = DARRAY_AT(b->outlines[i], XRectangle, k);
+			soft_outline(s, r.x, r.y, r.width, r.height, pixel);
+		}
+		darray_clear(b->outlines[i]);
+	}
+	darray_clear(b->pending);
+}
+
+// Fills with whatever a GC fills with
+void soft_fillGC(softsurface* s, int x, int y, int w, int h, GC gc) {
+	soft_fill(s, x, y, w, h, soft_gcPixel(s, gc));
+}
+
+static softglyph* soft_renderGlyph(XftFont* font, FT_UInt glyph) {
+	softglyph* g = calloc(1, sizeof(softglyph));
+	FT_Face face = XftLockFace(font);
+	if (face == NULL)
+		return g;
+	if (FT_Load_Glyph(face, glyph, FT_LOAD_RENDER) == 0) {
+		FT_Bitmap* bitmap = &face->glyph->bitmap;
+		g->width = bitmap->width;
+		g->height = bitmap->rows;
+		g->left = face->glyph->bitmap_left;
+		g->top = face->glyph->bitmap_top;
+		g->coverage = malloc(g->width * g->height + 1);
+		for (int row=0; row<g->height; row++) {
+			unsigned char* src = bitmap->buffer + row * bitmap->pitch;
+			unsigned char* dst = g->coverage + row * g->width;
+			for (int col=0; col<g->width; col++) {
+				if (bitmap->pixel_mode == FT_PIXEL_MODE_MONO)
+					dst[col] = (src[col / 8] >> (7 - col % 8)) & 1 ? 255 : 0;
+				else if (bitmap->pixel_mode == FT_PIXEL_MODE_GRAY)
+					dst[col] = src[col];
+				else
+					dst[col] = 0; // color glyphs aren't supported
+			}
+		}
+	}
+	XftUnlockFace(font);
+	return g;
+}
+
+static softglyph* soft_glyph(softsurface* s, XftFont* font, FT_UInt glyph) {
+	wtable* glyphs = wtable_get(s->fonts, (unsigned long)font);
+	if (glyphs == NULL) {
+		glyphs = wtable_create();
+		wtable_put(s->fonts, (unsigned long)font, glyphs);
+	}
+	softglyph* g = wtable_get(glyphs, glyph + 1);
+	if (g == NULL) {
+		g = soft_renderGlyph(font, glyph);
+		wtable_put(glyphs, glyph + 1, g);
+	}
+	return g;
+}
+
+static void soft_blendGlyph(softsurface* s, softglyph* g, int x, int y, uint32_t color) {
+	int x1 = x < s->clip.x ? s->clip.x : x;
+	int y1 = y < s->clip.y ? s->clip.y : y;
+	int x2 = x + g->width < s->clip.x + s->clip.width ? x + g->width : s->clip.x + s->clip.width;
+	int y2 = y + g->height < s->clip.y + s->clip.height ? y + g->height : s->clip.y + s->clip.height;
+	int r = (color >> 16) & 0xff, gr = (color >> 8) & 0xff, b = color & 0xff;
+	for (int row=y1; row<y2; row++) {
+		uint32_t* span = s->pixels + row * s->stride;
+		unsigned char* cov = g->coverage + (row - y) * g->width - x;
+		for (int col=x1; col<x2; col++) {
+			int a = cov[col];
+			if (a == 0)
+				continue;
+			uint32_t d = span[col];
+			int dr = (d >> 16) & 0xff, dg = (d >> 8) & 0xff, db = d & 0xff;
+			dr += ((r - dr) * a + 127) / 255;
+			dg += ((gr - dg) * a + 127) / 255;
+			db += ((b - db) * a + 127) / 255;
+			span[col] = (dr << 16) | (dg << 8) | db;
+		}
+	}
+}
+
+// Draws a run with its first glyph's origin at x, y
+void soft_drawRun(softsurface* s, fontrun* run, int x, int y, uint32_t color) {
+	for (int i=0; i<run->n; i++) {
+		XftGlyphFontSpec* spec = &run->glyphs[i];
+		softglyph* g = soft_glyph(s, spec->font, spec->glyph);
+		if (g->coverage)
+			soft_blendGlyph(s, g, x + spec->x + g->left, y + spec->y - g->top, color);
+	}
+}
+
+static void soft_freeGlyphs(wtable* glyphs) {
+	for (int i=0; i<glyphs->capacity; i++) {
+		softglyph* g = glyphs->values[i];
+		if (glyphs->keys[i] != 0 && g != NULL) {
+			free(g->coverage);
+			free(g);
+		}
+	}
+	wtable_free(glyphs);
+}
+
+// Fonts are about to be closed, their glyphs may not be looked up again
+void soft_clearGlyphs(softsurface* s) {
+	for (int i=0; i<s->fonts->capacity; i++) {
+		if (s->fonts->keys[i] != 0)
+			soft_freeGlyphs(s->fonts->values[i]);
+	}
+	wtable_clear(s->fonts);
+}
+
+// Copies part of the frame to the same place in w
+void soft_present(softsurface* s, Window w, GC gc, int x, int y, int width, int height) {
+	if (x < 0) { width += x; x = 0; }
+	if (y < 0) { height += y; y = 0; }
+	if (x + width > s->width)
+		width = s->width - x;
+	if (y + height > s->height)
+		height = s->height - y;
+	if (width <= 0 || height <= 0)
+		return;
+	if (s->useShm) {
+		XShmPutImage(s->dpy, w, gc, s->image, x, y, x, y, width, height, False);
+		s->inFlight = 1;
+	} else {
+		XPutImage(s->dpy, w, gc, s->image, x, y, x, y, width, height);
+	}
+}
+
+void soft_free(softsurface* s) {
+	soft_clearGlyphs(s);
+	wtable_free(s->fonts);
+	soft_destroyImage(s);
+	free(s);
+}
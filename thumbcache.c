@@ -0,0 +1,129 @@
+// The last contents seen of windows that have since been unmapped, which
+// is every window on a desktop that isn't on screen.  Stills are kept in
+// our memory at the size of their preview as 16 bit RGB565, and once the
+// budget is exceeded the ones looked at least recently are dropped.
+
+typedef struct {
+	Window window;
+	int width;
+	int height;
+	uint16_t* pixels;
+	unsigned long lastUsed;
+} thumbstill;
+
+typedef struct {
+	Display* dpy;
+	Visual* visual;
+	int depth;
+	wtable* stills; // windowId -> thumbstill*
+	size_t used;    // bytes of pixels held
+	size_t budget;
+	unsigned long clock;
+} thumbcache;
+
+// NULL if the default visual isn't 8 bits per channel TrueColor,
+// which is what stills are converted from and back to
+thumbcache* thumbcache_create(Display* dpy, int screen, size_t budget) {
+	Visual* visual = DefaultVisual(dpy, screen);
+	int depth = DefaultDepth(dpy, screen);
+	if (visual->class != TrueColor || (depth != 24 && depth != 32) ||
+			visual->red_mask != 0xff0000 || visual->green_mask != 0xff00 || visual->blue_mask != 0xff)
+		return NULL;
+
+	thumbcache* cache = malloc(sizeof(thumbcache));
+	cache->dpy = dpy;
+	cache->visual = visual;
+	cache->depth = depth;
+	cache->stills = wtable_create();
+	cache->used = 0;
+	cache->budget = budget;
+	cache->clock = 0;
+	return cache;
+}
+
+static void thumbcache_drop(thumbcache* cache, thumbstill* still) {
+	wtable_remove(cache->stills, still->window);
+	cache->used -= still->width * still->height * sizeof(uint16_t);
+	free(still->pixels);
+	free(still);
+}
+
+void thumbcache_remove(thumbcache* cache, Window w) {
+	thumbstill* still = wtable_get(cache->stills, w);
+	if (still != NULL)
+		thumbcache_drop(cache, still);
+}
+
+// The still of w, or NULL if there's none
+thumbstill* thumbcache_get(thumbcache* cache, Window w) {
+	thumbstill* still = wtable_get(cache->stills, w);
+	if (still != NULL)
+		still->lastUsed = ++cache->clock;
+	return still;
+}
+
+// Keeps the contents of image as the still of w, replacing the old one
+void thumbcache_put(thumbcache* cache, Window w, XImage* image) {
+	size_t size = image->width * image->height * sizeof(uint16_t);
+	thumbcache_remove(cache, w);
+	if (size > cache->budget || image->bits_per_pixel != 32)
+		return;
+	while (cache->used + size > cache->budget) {
+		thumbstill* oldest = NULL;
+		for (int i=0; i<cache->stills->capacity; i++) {
+			thumbstill* still = cache->stills->values[i];
+			if (cache->stills->keys[i] != 0 && (oldest == NULL || still->lastUsed < oldest->lastUsed))
+				oldest = still;
+		}
+		thumbcache_drop(cache, oldest);
+	}
+
+	thumbstill* still = malloc(sizeof(thumbstill));
+	still->window = w;
+	still->width = image->width;
+	still->height = image->height;
+	still->pixels = malloc(size);
+	still->lastUsed = ++cache->clock;
+	for (int y=0; y<image->height; y++) {
+		uint32_t* src = (uint32_t*)(image->data + y * image->bytes_per_line);
+		uint16_t* dst = still->pixels + y * image->width;
+		for (int x=0; x<image->width; x++) {
+			uint32_t p = src[x];
+			dst[x] = ((p >> 8) & 0xf800) | ((p >> 5) & 0x07e0) | ((p >> 3) & 0x001f);
+		}
+	}
+	wtable_put(cache->stills, w, still);
+	cache->used += size;
+}
+
+// Draws still stretched to width by height at x, y of d.  Previews don't
+// change size often, nearest neighbour is good enough until the next still.
+void thumbcache_draw(thumbcache* cache, thumbstill* still, Drawable d, GC gc, int x, int y, int width, int height) {
+	if (width <= 0 || height <= 0)
+		return;
+	XImage* image = XCreateImage(cache->dpy, cache->visual, cache->depth, ZPixmap, 0,
+			malloc(width * height * 4), width, height, 32, 0);
+	for (int row=0; row<height; row++) {
+		uint16_t* src = still->pixels + (row * still->height / height) * still->width;
+		uint32_t* dst = (uint32_t*)(image->data + row * image->bytes_per_line);
+		for (int col=0; col<width; col++) {
+			uint16_t p = src[col * still->width / width];
+			uint32_t r = (p >> 11) & 0x1f, g = (p >> 5) & 0x3f, b = p & 0x1f;
+			dst[col] = ((r << 3 | r >> 2) << 16) | ((g << 2 | g >> 4) << 8) | (b << 3 | b >> 2);
+		}
+	}
+	XPutImage(cache->dpy, d, gc, image, 0, 0, x, y, width, height);
+	XDestroyImage(image);
+}
+
+void thumbcache_free(thumbcache* cache) {
+	for (int i=0; i<cache->stills->capacity; i++) {
+		thumbstill* still = cache->stills->values[i];
+		if (cache->stills->keys[i] != 0) {
+			free(still->pixels);
+			free(still);
+		}
+	}
+	wtable_free(cache->stills);
+	free(cache);
+}
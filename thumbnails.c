@@ -0,0 +1,225 @@
+#include <time.h>
+#include <sys/select.h>
+#include <X11/extensions/Xcomposite.h>
+#include <X11/extensions/Xdamage.h>
+#include <X11/extensions/Xrender.h>
+
+// Live contents for the previews of mapped windows.  Each window is
+// redirected with Composite, which keeps its contents in an offscreen
+// pixmap, and Render scales that pixmap into the preview on the server.
+// Damage tells us when a window has drawn something.  A thumbnail is
+// repainted at most once per interval however often its window draws, so a
+// video player can't keep the pager busy.  Unmapped windows (the ones on
+// other desktops) have no contents and stay flat rectangles.
+
+typedef struct {
+	Window window;
+	Damage damage;
+	Pixmap pixmap;   // None until named, and again after a resize
+	Picture picture;
+	XRenderPictFormat* format;
+	char hasAlpha;
+	char damaged;    // drawn to since the last repaint
+	long lastDrawn;  // ms, see thumbs_now()
+	int workspace;   // where the preview is, as of the last sync
+	unsigned long generation; // last sync that still wanted it
+} thumbnail;
+
+typedef struct {
+	Display* dpy;
+	wtable* windows;  // windowId -> thumbnail*
+	int damageEvent;  // first event code of Damage
+	long interval;    // ms between two repaints of one thumbnail
+	long nextDue;     // ms when the next damaged thumbnail may be repainted, -1 if none
+	unsigned long generation;
+	XRenderPictFormat* dstFormat;
+} thumbnails;
+
+// Major opcodes of the extensions used, to tell their errors apart
+static int thumbs_opcodes[3];
+
+long thumbs_now() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+// NULL if the server is missing one of the extensions
+thumbnails* thumbs_create(Display* dpy, int screen, long interval) {
+	int event, error, major, minor = 2;
+	char* names[3] = {COMPOSITE_NAME, DAMAGE_NAME, RENDER_NAME};
+	for (int i=0; i<3; i++) {
+		if (!XQueryExtension(dpy, names[i], &thumbs_opcodes[i], &event, &error)) {
+			printf("No %s extension, thumbnails disabled\n", names[i]);
+			return NULL;
+		}
+	}
+	// NameWindowPixmap is new in 0.2
+	major = 0;
+	XCompositeQueryVersion(dpy, &major, &minor);
+	if (major == 0 && minor < 2) {
+		puts("Composite too old, thumbnails disabled");
+		return NULL;
+	}
+
+	thumbnails* t = malloc(sizeof(thumbnails));
+	XDamageQueryExtension(dpy, &t->damageEvent, &error);
+	t->dpy = dpy;
+	t->windows = wtable_create();
+	t->interval = interval;
+	t->nextDue = -1;
+	t->generation = 0;
+	t->dstFormat = XRenderFindVisualFormat(dpy, DefaultVisual(dpy, screen));
+	return t;
+}
+
+// Windows go away without asking us first, so requests on their
+// thumbnails can fail at any time
+char thumbs_ownsError(XErrorEvent* e) {
+	for (int i=0; i<3; i++) {
+		if (thumbs_opcodes[i] != 0 && e->request_code == thumbs_opcodes[i])
+			return 1;
+	}
+	return 0;
+}
+
+thumbnail* thumbs_get(thumbnails* t, Window w) {
+	return wtable_get(t->windows, w);
+}
+
+// Starts tracking the contents of w, NULL if it's already gone
+thumbnail* thumbs_add(thumbnails* t, Window w) {
+	XWindowAttributes wattr;
+	if (!XGetWindowAttributes(t->dpy, w, &wattr))
+		return NULL;
+	XRenderPictFormat* format = XRenderFindVisualFormat(t->dpy, wattr.visual);
+	if (format == NULL)
+		return NULL;
+
+	thumbnail* th = malloc(sizeof(thumbnail));
+	th->window = w;
+	th->format = format;
+	th->hasAlpha = format->type == PictTypeDirect && format->direct.alphaMask;
+	th->pixmap = None;
+	th->picture = None;
+	th->damaged = 1; // nothing shown yet
+	th->lastDrawn = 0;
+	th->workspace = -1;
+	th->generation = t->generation;
+	XCompositeRedirectWindow(t->dpy, w, CompositeRedirectAutomatic);
+	th->damage = XDamageCreate(t->dpy, w, XDamageReportNonEmpty);
+	wtable_put(t->windows, w, th);
+	return th;
+}
+
+static void thumbs_release(thumbnails* t, thumbnail* th) {
+	if (th->picture != None)
+		XRenderFreePicture(t->dpy, th->picture);
+	if (th->pixmap != None)
+		XFreePixmap(t->dpy, th->pixmap);
+	th->picture = None;
+	th->pixmap = None;
+}
+
+void thumbs_remove(thumbnails* t, Window w) {
+	thumbnail* th = wtable_remove(t->windows, w);
+	if (th == NULL)
+		return;
+	thumbs_release(t, th);
+	XDamageDestroy(t->dpy, th->damage);
+	XCompositeUnredirectWindow(t->dpy, w, CompositeRedirectAutomatic);
+	free(th);
+}
+
+// A resized window gets a new pixmap, the old one keeps the old contents
+void thumbs_invalidate(thumbnails* t, Window w) {
+	thumbnail* th = wtable_get(t->windows, w);
+	if (th == NULL)
+		return;
+	thumbs_release(t, th);
+	th->damaged = 1;
+}
+
+// Whether e was a Damage event.  The damage is acknowledged right away,
+// the repaint happens once the thumbnail is due.
+char thumbs_handleEvent(thumbnails* t, XEvent* e) {
+	if (e->type != t->damageEvent + XDamageNotify)
+		return 0;
+	XDamageNotifyEvent* d = (XDamageNotifyEvent*)e;
+	XDamageSubtract(t->dpy, d->damage, None, None);
+	thumbnail* th = wtable_get(t->windows, d->drawable);
+	if (th != NULL)
+		th->damaged = 1;
+	return 1;
+}
+
+// ms until the next thumbnail is due, -1 if none is waiting
+long thumbs_timeout(thumbnails* t) {
+	if (t->nextDue < 0)
+		return -1;
+	long wait = t->nextDue - thumbs_now();
+	return wait > 0 ? wait : 0;
+}
+
+// Scales the window's contents (srcWidth by srcHeight) into x, y, width, height of dst
+void thumbs_draw(thumbnails* t, thumbnail* th, Picture dst, int x, int y, int width, int height,
+		int srcWidth, int srcHeight) {
+	th->damaged = 0;
+	th->lastDrawn = thumbs_now();
+	if (width <= 0 || height <= 0)
+		return;
+	if (th->picture == None) {
+		th->pixmap = XCompositeNameWindowPixmap(t->dpy, th->window);
+		th->picture = XRenderCreatePicture(t->dpy, th->pixmap, th->format, 0, NULL);
+		XRenderSetPictureFilter(t->dpy, th->picture, FilterBilinear, NULL, 0);
+	}
+	// Maps destination pixels back onto the source
+	XTransform scale = {{
+		{XDoubleToFixed((double)srcWidth / width), 0, 0},
+		{0, XDoubleToFixed((double)srcHeight / height), 0},
+		{0, 0, XDoubleToFixed(1)},
+	}};
+	XRenderSetPictureTransform(t->dpy, th->picture, &scale);
+	XRenderComposite(t->dpy, th->hasAlpha ? PictOpOver : PictOpSrc, th->picture, None, dst,
+			0, 0, 0, 0, x, y, width, height);
+}
+
+// The contents last shown of th scaled to width by height, NULL if it was
+// never shown.  Still works after an unmap, a named pixmap outlives it.
+XImage* thumbs_capture(thumbnails* t, thumbnail* th, int width, int height, int srcWidth, int srcHeight) {
+	if (th->picture == None || width <= 0 || height <= 0)
+		return NULL;
+	Window root = DefaultRootWindow(t->dpy);
+	Pixmap pixmap = XCreatePixmap(t->dpy, root, width, height, t->dstFormat->depth);
+	Picture picture = XRenderCreatePicture(t->dpy, pixmap, t->dstFormat, 0, NULL);
+	thumbs_draw(t, th, picture, 0, 0, width, height, srcWidth, srcHeight);
+	XImage* image = XGetImage(t->dpy, pixmap, 0, 0, width, height, AllPlanes, ZPixmap);
+	XRenderFreePicture(t->dpy, picture);
+	XFreePixmap(t->dpy, pixmap);
+	return image;
+}
+
+// Waits at most timeout ms for an event, forever if negative.  Returns 0 on timeout.
+char thumbs_wait(Display* dpy, long timeout) {
+	if (timeout < 0 || XPending(dpy))
+		return 1;
+	int fd = ConnectionNumber(dpy);
+	fd_set fds;
+	FD_ZERO(&fds);
+	FD_SET(fd, &fds);
+	struct timeval tv = {timeout / 1000, (timeout % 1000) * 1000};
+	return select(fd + 1, &fds, NULL, NULL, &tv) > 0;
+}
+
+void thumbs_free(thumbnails* t) {
+	darray* windows = darray_create(sizeof(Window));
+	for (int i=0; i<t->windows->capacity; i++) {
+		if (t->windows->keys[i] != 0)
+			darray_addBack(windows, &t->windows->keys[i]);
+	}
+	for (int i=0; i<windows->size; i++)
+		thumbs_remove(t, DARRAY_AT(windows, Window, i));
+	darray_free(windows);
+	wtable_free(t->windows);
+	free(t);
+}
@@ -0,0 +1,116 @@
+// Hash table of X window ids to arbitrary data.
+// Open addressing with linear probing. Window ids are never 0 (None), so
+// a zero key marks an empty slot.
+
+typedef struct {
+	unsigned long* keys;
+	void** values;
+	int capacity; // always a power of two
+	int size;
+} wtable;
+
+wtable* wtable_create() {
+	wtable* table = malloc(sizeof(wtable));
+	table->capacity = 64;
+	table->size = 0;
+	table->keys = calloc(table->capacity, sizeof(unsigned long));
+	table->values = calloc(table->capacity, sizeof(void*));
+	return table;
+}
+
+// Window ids are allocated sequentially per client with the client's
+// resource base in the high bits, so mix both halves into the slot
+static int wtable_slot(wtable* table, unsigned long key) {
+	key ^= key >> 16;
+	key *= 0x45d9f3b;
+	key ^= key >> 16;
+	return key & (table->capacity - 1);
+}
+
+void* wtable_get(wtable* table, unsigned long key) {
+	int i = wtable_slot(table, key);
+	while (table->keys[i] != 0) {
+		if (table->keys[i] == key)
+			return table->values[i];
+		i = (i + 1) & (table->capacity - 1);
+	}
+	return NULL;
+}
+
+void wtable_put(wtable* table, unsigned long key, void* data);
+
+static void wtable_grow(wtable* table) {
+	unsigned long* oldKeys = table->keys;
+	void** oldValues = table->values;
+	int oldCapacity = table->capacity;
+
+	table->capacity *= 2;
+	table->size = 0;
+	table->keys = calloc(table->capacity, sizeof(unsigned long));
+	table->values = calloc(table->capacity, sizeof(void*));
+	for (int i=0; i<oldCapacity; i++) {
+		if (oldKeys[i] != 0)
+			wtable_put(table, oldKeys[i], oldValues[i]);
+	}
+	free(oldKeys);
+	free(oldValues);
+}
+
+void wtable_put(wtable* table, unsigned long key, void* data) {
+	// Keep the load factor under 3/4 so probe chains stay short
+	if ((table->size + 1) * 4 > table->capacity * 3)
+		wtable_grow(table);
+
+	int i = wtable_slot(table, key);
+	while (table->keys[i] != 0) {
+		if (table->keys[i] == key) {
+			table->values[i] = data;
+			return;
+		}
+		i = (i + 1) & (table->capacity - 1);
+	}
+	table->keys[i] = key;
+	table->values[i] = data;
+	table->size++;
+}
+
+// Removes key and returns its data, or NULL if it wasn't present
+void* wtable_remove(wtable* table, unsigned long key) {
+	int mask = table->capacity - 1;
+	int i = wtable_slot(table, key);
+	while (table->keys[i] != key) {
+		if (table->keys[i] == 0)
+			return NULL;
+		i = (i + 1) & mask;
+	}
+	void* data = table->values[i];
+
+	// Shift later members of the probe chain back so lookups never
+	// stop early at the hole we just made (no tombstones needed)
+	int hole = i;
+	for (int j = (i + 1) & mask; table->keys[j] != 0; j = (j + 1) & mask) {
+		int home = wtable_slot(table, table->keys[j]);
+		// Move j into the hole if its home slot isn't between the hole and j
+		if (((j - home) & mask) >= ((j - hole) & mask)) {
+			table->keys[hole] = table->keys[j];
+			table->values[hole] = table->values[j];
+			hole = j;
+		}
+	}
+	table->keys[hole] = 0;
+	table->values[hole] = NULL;
+	table->size--;
+	return data;
+}
+
+void wtable_clear(wtable* table) {
+	memset(table->keys, 0, table->capacity * sizeof(unsigned long));
+	memset(table->values, 0, table->capacity * sizeof(void*));
+	table->size = 0;
+}
+
+void wtable_free(wtable* table) {
+	free(table->keys);
+	free(table->values);
+	free(table);
+}